@@ -0,0 +1,549 @@
+// pospace_bench.cpp : timings of the hot paths, as JSON for regression
+// tracking.
+//   pospace_bench [--quick] [--json <file>] [--dir <path>]
+//     [--filter <name part>] [--tree-level-step <k>] [--threads <n>]
+// The sectors are made in --dir, a temp directory by default, and removed
+// afterwards. Without --json the JSON goes to stdout after the table.
+// generate_proofs_mt_* prove one sector from 1, 2, 4 .. --threads threads
+// (the cores by default), the rate should grow with them until the disk or
+// the memory bus is saturated. verifier_pool_t* verify the packed proofs of
+// several small sectors on pools of as many threads. batch_create_16m_k<K>
+// makes K sectors in lockstep on one core, to hold against create_16m.
+// get_mkl_paths_legacy_block_<N> is the GetMklPaths of per node flags the
+// sweep replaced, to hold against get_mkl_paths_block_<N>.
+
+#include "public.h"
+#include "sector_prover.h"
+#include "sector_batch_creator.h"
+#include "sector_verifier.h"
+#include "sector_mkl.h"
+#include "sector_metrics.h"
+#include "verifier_pool.h"
+#include "sha256_compress.h"
+#include <thread>
+
+// the private steps of SectorProver
+struct SectorBench {
+	static void CreateItem(SectorProver& prover, uint64_t n,
+		SectorItem const& dx, SectorItem const& dy, SectorItem* dn) {
+		prover.CreateItem(n, dx, dy, dn);
+	}
+
+	static void GetMklPaths(SectorProver& prover,
+		std::vector<uint64_t> const& leafs,
+		std::vector<std::vector<SectorItem>>& paths) {
+		prover.GetMklPaths(leafs, paths);
+	}
+};
+
+namespace {
+
+struct Result {
+	std::string name;
+	uint64_t ops = 0; // hashes, items or proofs, see the name
+	uint64_t bytes = 0;
+	double seconds = 0;
+};
+
+struct Bench {
+	bool quick = false;
+	std::string filter;
+	size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<Result> results;
+
+	bool Wanted(std::string const& name) const {
+		return filter.empty() || name.find(filter) != std::string::npos;
+	}
+
+	// of the proof steps of a sector
+	std::vector<size_t> ChallengeCounts() const {
+		if (quick)
+			return { 1, 16, 256 };
+		return { 1, 16, 256, 4096 };
+	}
+
+	// 1, 2, 4 .. max_threads
+	std::vector<size_t> ThreadCounts() const {
+		std::vector<size_t> ret;
+		for (size_t thread_count = 1;; thread_count *= 2) {
+			thread_count = std::min(thread_count, max_threads);
+			ret.push_back(thread_count);
+			if (thread_count == max_threads)
+				return ret;
+		}
+	}
+
+	void Report(Result const& result) {
+		results.push_back(result);
+		std::cout << std::left << std::setw(32) << result.name <<
+			std::right << std::setw(12) << std::fixed << std::setprecision(1) <<
+			result.seconds * 1e9 / result.ops << " ns/op " <<
+			std::setw(14) << std::setprecision(0) <<
+			result.ops / result.seconds << " op/s";
+		if (result.bytes) {
+			std::cout << std::setw(10) << std::setprecision(1) <<
+				result.bytes / result.seconds / kSectorSizeM << " MB/s";
+		}
+		std::cout << std::endl;
+	}
+
+	// fn does ops operations over bytes, repeated for a while
+	void Run(std::string const& name, uint64_t ops, uint64_t bytes,
+		std::function<void()> const& fn) {
+		if (!Wanted(name))
+			return;
+		double const min_seconds = quick ? 0.1 : 1.0;
+		Result result;
+		result.name = name;
+		auto start = std::chrono::steady_clock::now();
+		do {
+			fn();
+			result.ops += ops;
+			result.bytes += bytes;
+			result.seconds = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+		} while (result.seconds < min_seconds);
+		Report(result);
+	}
+
+	// fn does ops operations on thread t of thread_count, all of them
+	// repeated for a while
+	void RunThreads(std::string const& name, size_t thread_count,
+		uint64_t ops, std::function<void(size_t t)> const& fn) {
+		if (!Wanted(name))
+			return;
+		double const min_seconds = quick ? 0.1 : 1.0;
+		std::atomic<uint64_t> total(0);
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < thread_count; ++t) {
+			threads.emplace_back([&, t]() {
+				do {
+					fn(t);
+					total += ops;
+				} while (std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count() <
+					min_seconds);
+			});
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		Result result;
+		result.name = name;
+		result.ops = total;
+		result.seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		Report(result);
+	}
+
+	// a single run, for the long steps
+	bool Once(std::string const& name, uint64_t ops, uint64_t bytes,
+		std::function<bool()> const& fn) {
+		Result result;
+		result.name = name;
+		result.ops = ops;
+		result.bytes = bytes;
+		auto start = std::chrono::steady_clock::now();
+		bool ok = fn();
+		result.seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		if (ok)
+			Report(result);
+		else
+			std::cout << name << " failed" << std::endl;
+		return ok;
+	}
+
+	std::string ToJson(std::string const& sha256,
+		uint32_t tree_level_step) const {
+		std::ostringstream out;
+		out << std::setprecision(9);
+		out << "{\n  \"sha256\": \"" << sha256 << "\",\n";
+		out << "  \"quick\": " << (quick ? "true" : "false") << ",\n";
+		out << "  \"tree_level_step\": " << tree_level_step << ",\n";
+		out << "  \"max_threads\": " << max_threads << ",\n";
+		out << "  \"results\": [";
+		for (size_t i = 0; i < results.size(); ++i) {
+			auto const& result = results[i];
+			out << (i ? ",\n" : "\n") << "    {\"name\": \"" << result.name <<
+				"\", \"ops\": " << result.ops << ", \"bytes\": " <<
+				result.bytes << ", \"seconds\": " << result.seconds <<
+				", \"ns_per_op\": " << result.seconds * 1e9 / result.ops <<
+				", \"ops_per_second\": " << result.ops / result.seconds << "}";
+		}
+		out << "\n  ],\n  \"metrics\": " << SectorMetrics::ToJson() << "}\n";
+		return out.str();
+	}
+};
+
+std::vector<SectorItem> RandomItems(size_t count, std::mt19937_64& rng) {
+	std::vector<SectorItem> items(count);
+	for (auto& item : items) {
+		for (auto& i : item.data) i = (uint32_t)rng();
+	}
+	return items;
+}
+
+void BenchSha256(Bench& bench) {
+	// latency: each block takes the state before it, as the chain does
+	uint32_t const kChain = 4096;
+	uint32_t block[16] = {};
+	bench.Run("sha256_compress2_latency", kChain, kChain * 64, [&]() {
+		for (uint32_t i = 0; i < kChain; ++i) {
+			Sha256Compress2(block, block);
+		}
+	});
+
+	// throughput: independent blocks over the widest lanes
+	size_t const kBlocks = 4096;
+	std::vector<uint32_t> data(kBlocks * 16, 1);
+	std::vector<uint32_t> hash(kBlocks * 8);
+	bench.Run("sha256_compress2_batch", kBlocks, kBlocks * 64, [&]() {
+		Sha256Compress2Batch(data.data(), hash.data(), kBlocks);
+	});
+}
+
+void BenchCreateItem(Bench& bench, std::string const& dir) {
+	SectorProver prover("abcd", "bench", kSectorSizeM, dir);
+	std::mt19937_64 rng(1);
+	std::vector<SectorItem> items = RandomItems(1 << 16, rng);
+	uint64_t const mask = items.size() - 1;
+	uint64_t n = 1;
+	bench.Run("create_item", items.size(), items.size() * sizeof(SectorItem),
+		[&]() {
+		for (size_t i = 0; i < items.size(); ++i, ++n) {
+			SectorItem const& dn_1 = items[(n - 1) & mask];
+			SectorItem const& dy = items[dn_1.get_parent_y(n) & mask];
+			SectorBench::CreateItem(prover, n, dn_1, dy, &items[n & mask]);
+		}
+	});
+}
+
+void BenchMklRoot(Bench& bench) {
+	std::mt19937_64 rng(1);
+	for (uint64_t count : { 1 << 10, 1 << 16, 1 << 20 }) {
+		if (bench.quick && count > (1 << 16))
+			continue;
+		std::vector<SectorItem> items = RandomItems((size_t)count, rng);
+		SectorItem root;
+		bench.Run("mkl_root_" + std::to_string(count), count,
+			count * sizeof(SectorItem), [&]() {
+			CaculateMklRoot(items.data(), count, &root);
+		});
+	}
+}
+
+// the paths of a block of 2^16 leafs, by the sorted-leaf sweep the prover
+// uses and by the flags it replaced
+void BenchMklPaths(Bench& bench) {
+	std::mt19937_64 rng(1);
+	std::vector<SectorItem> items = RandomItems(1 << 16, rng);
+	for (size_t count : { 16, 256, 2048 }) {
+		if (bench.quick && count > 256)
+			continue;
+		std::vector<uint64_t> leafs(count);
+		for (auto& leaf : leafs) {
+			leaf = rng() % items.size();
+		}
+		std::string const suffix = "_block_" + std::to_string(count);
+		SectorItem root;
+		bench.Run("get_mkl_paths" + suffix, count, 0, [&]() {
+			std::vector<std::vector<SectorItem>> paths;
+			GetMklPaths(items.data(), items.size(), leafs, paths, &root);
+		});
+		bench.Run("get_mkl_paths_legacy" + suffix, count, 0, [&]() {
+			std::vector<std::vector<SectorItem>> paths;
+			LegacyGetMklPaths(items.data(), items.size(), leafs, paths, &root);
+		});
+	}
+}
+
+// Create, Open, then the proof steps at several challenge counts
+bool BenchSector(Bench& bench, std::string const& dir, uint64_t data_size,
+	SectorOptions const& options) {
+	std::string const size = std::to_string(data_size / kSectorSizeM) + "m";
+	uint64_t const data_count = data_size / sizeof(SectorItem);
+	std::string const user_id = "abcd";
+	std::string const sector_id = "bench" + size;
+	auto const progress = [](int, std::string) {};
+
+	SectorItem root;
+	{
+		SectorProver prover(user_id, sector_id, data_size, dir, options);
+		if (!bench.Once("create_" + size, data_count, data_size, [&]() {
+			return prover.Create(progress);
+		})) {
+			return false;
+		}
+		root = prover.mkl_root();
+	}
+
+	SectorProver prover(user_id, sector_id, data_size, dir, options);
+	if (!bench.Once("open_fast_" + size, 1, 0, [&]() {
+		return prover.Open(SectorProver::FastIntegrityCheck);
+	})) {
+		return false;
+	}
+	SectorVerifier verifier(user_id, sector_id, data_size, root);
+
+	std::mt19937_64 rng(1);
+	for (size_t count : bench.ChallengeCounts()) {
+		std::vector<uint64_t> challenges(count);
+		for (auto& challenge : challenges) {
+			challenge = rng() % data_count;
+		}
+		std::string const suffix = "_" + size + "_" + std::to_string(count);
+
+		std::vector<std::vector<SectorItem>> paths;
+		bench.Run("get_mkl_paths" + suffix, count, 0, [&]() {
+			SectorBench::GetMklPaths(prover, challenges, paths);
+		});
+
+		// made once outside the timings, a filter may skip their runs
+		std::vector<SectorProof> proofs =
+			prover.GenerateProofs(challenges, nullptr);
+		std::vector<char> flat = prover.PackProofs(proofs);
+		std::vector<char> multiproof = prover.PackProofs(challenges, proofs);
+
+		bench.Run("generate_proofs" + suffix, count, 0, [&]() {
+			proofs = prover.GenerateProofs(challenges, nullptr);
+		});
+
+		bench.Run("pack_flat" + suffix, count, 0, [&]() {
+			flat = prover.PackProofs(proofs);
+		});
+		bench.Run("pack_multiproof" + suffix, count, 0, [&]() {
+			multiproof = prover.PackProofs(challenges, proofs);
+		});
+
+		bench.Run("unpack_flat" + suffix, count, flat.size(), [&]() {
+			verifier.UnpackProof(flat);
+		});
+		bench.Run("unpack_multiproof" + suffix, count, multiproof.size(),
+			[&]() {
+			verifier.UnpackProof(challenges, multiproof);
+		});
+
+		bool verified = true;
+		bench.Run("verify_proofs" + suffix, count, 0, [&]() {
+			verified = verifier.VerifyProofs(challenges, proofs) && verified;
+		});
+		bench.Run("prove_verify" + suffix, count, 0, [&]() {
+			auto packed = prover.GeneratePackedProofs(challenges, nullptr);
+			verified = verifier.VerifyPackedProofs(challenges, packed) &&
+				verified;
+		});
+		if (!verified) {
+			std::cout << "verify failed" << suffix << std::endl;
+			return false;
+		}
+	}
+
+	// one sector, many challenge streams, each thread with its own batch
+	size_t const count = 256;
+	std::vector<std::vector<uint64_t>> challenges(bench.max_threads);
+	for (auto& c : challenges) {
+		c.resize(count);
+		for (auto& challenge : c) {
+			challenge = rng() % data_count;
+		}
+	}
+	for (size_t thread_count : bench.ThreadCounts()) {
+		bench.RunThreads("generate_proofs_mt_" + size + "_t" +
+			std::to_string(thread_count), thread_count, count, [&](size_t t) {
+			prover.GenerateProofs(challenges[t], nullptr);
+		});
+	}
+	return true;
+}
+
+// packed proofs of small sectors through VerifierPool, as an audit server
+// gets them: many jobs of a few proofs, over fewer sectors
+bool BenchVerifierPool(Bench& bench, std::string const& dir) {
+	std::vector<size_t> thread_counts;
+	for (size_t thread_count : bench.ThreadCounts()) {
+		if (bench.Wanted("verifier_pool_t" + std::to_string(thread_count)))
+			thread_counts.push_back(thread_count);
+	}
+	if (thread_counts.empty())
+		return true;
+
+	size_t const kSectorCount = 4;
+	size_t const kJobCount = 64; // per sector
+	size_t const kChallengeCount = 16; // per job
+	uint64_t const data_size = kSectorSizeM;
+	struct Pending {
+		SectorDescriptor sector;
+		std::vector<uint64_t> challenges;
+		std::vector<char> packed_proofs;
+	};
+	std::vector<Pending> pendings;
+	std::mt19937_64 rng(1);
+	for (size_t i = 0; i < kSectorCount; ++i) {
+		SectorDescriptor sector;
+		sector.user_id = "abcd";
+		sector.sector_id = "bench_pool" + std::to_string(i);
+		sector.data_size = data_size;
+		SectorProver prover(sector.user_id, sector.sector_id, data_size, dir);
+		if (!prover.Create(nullptr)) {
+			std::cout << "verifier_pool create failed" << std::endl;
+			return false;
+		}
+		sector.mkl_root = prover.mkl_root();
+		for (size_t j = 0; j < kJobCount; ++j) {
+			Pending pending;
+			pending.sector = sector;
+			for (size_t k = 0; k < kChallengeCount; ++k) {
+				pending.challenges.push_back(rng());
+			}
+			pending.packed_proofs = prover.GeneratePackedProofs(
+				pending.challenges, nullptr);
+			pendings.push_back(std::move(pending));
+		}
+	}
+
+	bool verified = true;
+	for (size_t thread_count : thread_counts) {
+		VerifierPool pool(thread_count);
+		bench.Run("verifier_pool_t" + std::to_string(thread_count),
+			pendings.size() * kChallengeCount, 0, [&]() {
+			std::vector<std::future<bool>> futures;
+			for (auto const& pending : pendings) {
+				futures.push_back(pool.Verify(pending.sector,
+					pending.challenges, pending.packed_proofs));
+			}
+			for (auto& future : futures) {
+				verified = future.get() && verified;
+			}
+		});
+	}
+	if (!verified)
+		std::cout << "verifier_pool verify failed" << std::endl;
+	return verified;
+}
+
+// the sector is made only when one of its results is wanted, by the names
+// BenchSector gives them
+bool WantsSector(Bench const& bench, std::string const& size) {
+	std::vector<std::string> names = { "create_" + size,
+		"open_fast_" + size };
+	for (size_t count : bench.ChallengeCounts()) {
+		std::string const suffix = "_" + size + "_" + std::to_string(count);
+		for (std::string name : { "get_mkl_paths", "generate_proofs",
+			"pack_flat", "pack_multiproof", "unpack_flat",
+			"unpack_multiproof", "verify_proofs", "prove_verify" }) {
+			names.push_back(name + suffix);
+		}
+	}
+	for (size_t thread_count : bench.ThreadCounts()) {
+		names.push_back("generate_proofs_mt_" + size + "_t" +
+			std::to_string(thread_count));
+	}
+	for (auto const& name : names) {
+		if (bench.Wanted(name))
+			return true;
+	}
+	return false;
+}
+
+void RemoveSectors(std::string const& dir) {
+	std::error_code error_code;
+	for (auto const& entry : fs::directory_iterator(dir, error_code)) {
+		if (entry.path().filename().string().compare(0, 5, "bench") == 0)
+			fs::remove(entry.path(), error_code);
+	}
+}
+
+// K sectors through SectorBatchCreator, the items of all of them per second
+bool BenchBatchCreate(Bench& bench, std::string const& dir,
+	uint64_t data_size, SectorOptions const& options) {
+	std::string const size = std::to_string(data_size / kSectorSizeM) + "m";
+	uint64_t const data_count = data_size / sizeof(SectorItem);
+	bool ok = true;
+	for (size_t k : { 4, 8, 16 }) {
+		std::string const name = "batch_create_" + size + "_k" +
+			std::to_string(k);
+		if ((bench.quick && k > 8) || !bench.Wanted(name))
+			continue;
+		std::vector<std::unique_ptr<SectorProver>> provers;
+		std::vector<SectorProver*> batch;
+		for (size_t i = 0; i < k; ++i) {
+			provers.emplace_back(new SectorProver("abcd",
+				"bench_batch" + std::to_string(i), data_size, dir, options));
+			batch.push_back(provers.back().get());
+		}
+		SectorBatchCreator creator(batch);
+		ok = bench.Once(name, k * data_count, k * data_size, [&]() {
+			return creator.Create([](int, std::string) {});
+		}) && ok;
+		provers.clear();
+		RemoveSectors(dir);
+	}
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Bench bench;
+	std::string json_pathname;
+	std::string dir = (fs::temp_directory_path() / "pospace_bench").string();
+	SectorOptions options;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--quick") {
+			bench.quick = true;
+		} else if (arg == "--json" && has_value) {
+			json_pathname = argv[++i];
+		} else if (arg == "--dir" && has_value) {
+			dir = argv[++i];
+		} else if (arg == "--filter" && has_value) {
+			bench.filter = argv[++i];
+		} else if (arg == "--tree-level-step" && has_value) {
+			options.tree_level_step = (uint32_t)std::stoul(argv[++i]);
+		} else if (arg == "--threads" && has_value) {
+			bench.max_threads = std::max<size_t>(1, std::stoul(argv[++i]));
+		} else {
+			std::cout << "usage: " << argv[0] << " [--quick] [--json <file>]"
+				" [--dir <path>] [--filter <name part>]"
+				" [--tree-level-step <k>] [--threads <n>]" << std::endl;
+			return 2;
+		}
+	}
+
+	std::error_code error_code;
+	fs::create_directories(dir, error_code);
+	std::string sha256 = Sha256AutoDetect();
+	std::cout << "sha256: " << sha256 << std::endl;
+	SectorMetrics::Reset();
+
+	BenchSha256(bench);
+	BenchCreateItem(bench, dir);
+	BenchMklRoot(bench);
+	BenchMklPaths(bench);
+
+	bool ok = BenchVerifierPool(bench, dir);
+	RemoveSectors(dir);
+	std::vector<uint64_t> sizes{ 16 * kSectorSizeM };
+	if (!bench.quick)
+		sizes.push_back(256 * kSectorSizeM);
+	for (auto data_size : sizes) {
+		std::string size = std::to_string(data_size / kSectorSizeM) + "m";
+		if (!WantsSector(bench, size))
+			continue;
+		ok = BenchSector(bench, dir, data_size, options) && ok;
+		RemoveSectors(dir);
+	}
+	ok = BenchBatchCreate(bench, dir, 16 * kSectorSizeM, options) && ok;
+
+	std::string json = bench.ToJson(sha256, options.tree_level_step);
+	if (json_pathname.empty()) {
+		std::cout << json;
+	} else if (!WriteFileDurable(json_pathname, json.data(), json.size())) {
+		std::cout << "write " << json_pathname << " failed" << std::endl;
+		return 1;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,302 @@
+#include "sector_batch_creator.h"
+#include "sector_prover.h"
+#include "sector_mkl.h"
+#include "sector_verifier.h"
+#include "tick.h"
+
+// throw
+SectorBatchCreator::SectorBatchCreator(std::vector<SectorProver*> provers)
+	: provers_(std::move(provers)) {
+	if (provers_.empty()) {
+		throw std::runtime_error("empty provers");
+	}
+
+	std::set<std::string> pathnames;
+	for (auto prover : provers_) {
+		if (!prover) {
+			throw std::runtime_error("null prover");
+		}
+		if (prover->data_size_ != provers_[0]->data_size_) {
+			throw std::runtime_error("data_size mismatch");
+		}
+		// the lockstep chains read the whole data of every sector mapped,
+		// create such a sector alone, see SectorProver::InitData
+		if (prover->options_.ram_budget) {
+			throw std::runtime_error("ram_budget not supported");
+		}
+		for (auto const& pathname : prover->data_pathnames_) {
+			if (!pathnames.insert(pathname).second) {
+				throw std::runtime_error("duplicate sector");
+			}
+		}
+		if (!pathnames.insert(prover->meta_pathname_).second) {
+			throw std::runtime_error("duplicate sector");
+		}
+	}
+}
+
+bool SectorBatchCreator::Create(
+	SectorProgressCallback const& progress) noexcept {
+	for (auto prover : provers_) {
+		if (prover->data_view_ || prover->meta_view_)
+			return false;
+	}
+
+	if (!CheckSpace())
+		return false;
+
+	std::error_code error_code;
+	for (auto prover : provers_) {
+		fs::remove(prover->checkpoint_pathname_, error_code);
+	}
+
+	try {
+		InitData(progress);
+		for (auto prover : provers_) {
+			prover->OpenData();
+			prover->InitMeta(progress);
+			prover->OpenMeta();
+			prover->OpenTree();
+			if (!prover->BuildMetaTree())
+				throw std::runtime_error("meta root");
+			fs::remove(prover->checkpoint_pathname_, error_code);
+		}
+		return true;
+	} catch (std::exception&) {
+		Remove();
+		return false;
+	}
+}
+
+bool SectorBatchCreator::CheckSpace() noexcept {
+	std::map<std::string, uint64_t> want_spaces;
+	for (auto prover : provers_) {
+		prover->AddWantSpaces(want_spaces);
+	}
+
+	for (auto const& want_space : want_spaces) {
+		std::error_code error_code;
+		fs::space_info space = fs::space(want_space.first, error_code);
+		if (error_code)
+			return false;
+		if (space.available < want_space.second)
+			return false;
+	}
+	return true;
+}
+
+// sectors with a checkpoint are kept, see SectorProver::Resume
+void SectorBatchCreator::Remove() noexcept {
+	for (auto prover : provers_) {
+		prover->Remove();
+	}
+}
+
+// throw
+void SectorBatchCreator::InitData(SectorProgressCallback const& progress) {
+	Tick tick(__FUNCTION__);
+	size_t const lanes = provers_.size();
+	uint64_t const data_count = provers_[0]->data_count_;
+	uint64_t const block_size = provers_[0]->block_size_;
+
+	std::vector<std::unique_ptr<SectorStripedView>> items(lanes);
+	std::vector<std::unique_ptr<io::mapped_file>> meta_views(lanes);
+	std::vector<std::unique_ptr<io::mapped_file>> tree_views(lanes);
+	std::vector<SectorItem*> meta_items(lanes);
+	std::vector<SectorItem*> tree_items(lanes);
+	std::vector<SectorMklStack> mkl_stacks(lanes);
+	for (size_t i = 0; i < lanes; ++i) {
+		auto const& options = provers_[i]->options_;
+		items[i].reset(new SectorStripedView(provers_[i]->data_pathnames_,
+			provers_[i]->data_size_, options.stripe_size,
+			options.in_memory ? SectorStripedView::kMemory :
+			SectorStripedView::kCreate, options.numa_node));
+
+		io::mapped_file_params meta_params;
+		meta_params.path = provers_[i]->meta_pathname_;
+		meta_params.flags = io::mapped_file_base::readwrite;
+		meta_params.new_file_size = provers_[i]->meta_size_;
+		meta_views[i].reset(new io::mapped_file(meta_params));
+		meta_items[i] = (SectorItem*)meta_views[i]->data();
+		if (!meta_items[i])
+			throw std::runtime_error("init meta_view failed");
+
+		if (provers_[i]->tree_size_) {
+			io::mapped_file_params tree_params;
+			tree_params.path = provers_[i]->tree_pathname_;
+			tree_params.flags = io::mapped_file_base::readwrite;
+			tree_params.new_file_size = provers_[i]->tree_size_;
+			tree_views[i].reset(new io::mapped_file(tree_params));
+			tree_items[i] = (SectorItem*)tree_views[i]->data();
+			if (!tree_items[i])
+				throw std::runtime_error("init tree_view failed");
+			provers_[i]->SetTreeSink(mkl_stacks[i], tree_items[i], 0);
+		}
+	}
+
+	// block roots are streamed into the meta files and each sector takes its
+	// own checkpoints, see SectorProver::InitData
+	uint64_t const chunk_size = std::min(block_size,
+		SectorMklStack::kChunkSize);
+	std::vector<std::chrono::steady_clock::time_point> last_checkpoints(lanes,
+		std::chrono::steady_clock::now());
+	std::vector<uint64_t> synced_blocks(lanes);
+	auto checkpoint = [&](size_t i, uint64_t block_count) {
+		auto prover = provers_[i];
+		auto now = std::chrono::steady_clock::now();
+		if (!prover->options_.checkpoint_seconds || prover->options_.in_memory ||
+			block_count == prover->meta_count_ - 1 ||
+			now - last_checkpoints[i] <
+			std::chrono::seconds(prover->options_.checkpoint_seconds)) {
+			return;
+		}
+		uint64_t first = synced_blocks[i] * block_size;
+		if (items[i]->Sync(first, block_count * block_size - first) &&
+			prover->WriteCheckpoint(meta_items[i], tree_items[i],
+			synced_blocks[i], block_count)) {
+			synced_blocks[i] = block_count;
+		}
+		last_checkpoints[i] = now;
+	};
+	auto push_leafs = [&](uint64_t n) {
+		for (size_t i = 0; i < lanes; ++i) {
+			if ((n + 1) % chunk_size == 0) {
+				mkl_stacks[i].PushLeafs(&(*items[i])[n + 1 - chunk_size],
+					chunk_size);
+			}
+			if ((n + 1) % block_size == 0) {
+				meta_items[i][n / block_size] = mkl_stacks[i].root(block_size);
+				mkl_stacks[i].Clear();
+				checkpoint(i, (n + 1) / block_size);
+			}
+		}
+	};
+
+	// for SectorMetrics, at each progress report
+	uint64_t counted = 0;
+	auto count_items = [&](uint64_t n) {
+		SectorMetrics::Add(kSectorItemsCreated, lanes * (n - counted));
+		SectorMetrics::Add(kSectorBytesWritten,
+			lanes * (n - counted) * sizeof(SectorItem));
+		counted = n;
+	};
+
+	for (size_t i = 0; i < lanes; ++i) {
+		(*items[i])[0] = provers_[i]->d0_;
+	}
+	push_leafs(0);
+
+	// blocks[2i], blocks[2i+1] is the input of lane i, see CreateItem
+	std::vector<SectorItem> blocks(lanes * 2);
+	std::vector<SectorItem const*> dys(lanes);
+
+	for (uint64_t n = 1; n < data_count; ++n) {
+		// all parents first, so the random dy reads overlap
+		for (size_t i = 0; i < lanes; ++i) {
+			auto const& data_items = *items[i];
+			SectorItem const* dn_1 = &data_items[n - 1];
+			dys[i] = &data_items[dn_1->get_parent_y(n)];
+			SectorItem::Prefetch(dys[i]);
+		}
+
+		SectorItem const sn(n);
+		for (size_t i = 0; i < lanes; ++i) {
+			auto const& data_items = *items[i];
+			SectorItem const* dn_1 = &data_items[n - 1];
+			SectorItem const* dx = &data_items[dn_1->get_parent_x(n)];
+			SectorItem::Xor(provers_[i]->prefix_, *dx, &blocks[i * 2]);
+			SectorItem::Xor(sn, *dys[i], &blocks[i * 2 + 1]);
+		}
+
+		SectorItem::CompressTwoBatch(blocks.data(), lanes, blocks.data());
+		for (size_t i = 0; i < lanes; ++i) {
+			(*items[i])[n] = blocks[i];
+		}
+		push_leafs(n);
+
+		if (n % 1000000 == 0) {
+			count_items(n);
+			if (progress) {
+				progress((int)(n * 100 / data_count),
+					"init data: " + std::to_string(n));
+			}
+		}
+	}
+
+	count_items(data_count);
+
+	// see SectorProver::OpenData
+	for (size_t i = 0; i < lanes; ++i) {
+		if (provers_[i]->options_.in_memory)
+			provers_[i]->data_memory_ = std::move(items[i]);
+	}
+}
+
+// K sectors made in lockstep must equal K made alone: same roots, and the
+// proofs of the batch verify against the roots of the single Creates
+void test_batch_creator() {
+	std::string const path = "./test_batch_creator";
+	std::string const user_id = "abcd";
+	uint64_t const data_size = 4 * kSectorSizeM;
+	uint64_t const data_count = data_size / sizeof(SectorItem);
+	size_t const kSectors = 5; // not a multiple of the widest lanes
+
+	fs::remove_all(path);
+	fs::create_directories(path + "/batch");
+	fs::create_directories(path + "/alone");
+	for (uint32_t tree_level_step : { 0, 4 }) {
+		SectorOptions options;
+		options.tree_level_step = tree_level_step;
+		options.checkpoint_seconds = 0;
+
+		std::vector<SectorItem> roots;
+		for (size_t i = 0; i < kSectors; ++i) {
+			SectorProver prover(user_id, std::to_string(i), data_size,
+				path + "/alone", options);
+			bool ok = prover.Create(nullptr);
+			assert(ok);
+			(void)ok;
+			roots.push_back(prover.mkl_root());
+		}
+
+		std::vector<std::unique_ptr<SectorProver>> provers;
+		std::vector<SectorProver*> batch;
+		for (size_t i = 0; i < kSectors; ++i) {
+			provers.emplace_back(new SectorProver(user_id, std::to_string(i),
+				data_size, path + "/batch", options));
+			batch.push_back(provers.back().get());
+		}
+		bool ok = SectorBatchCreator(batch).Create(nullptr);
+		assert(ok);
+
+		std::mt19937_64 rng(tree_level_step);
+		for (size_t i = 0; i < kSectors; ++i) {
+			assert(provers[i]->mkl_root() == roots[i]);
+			std::vector<uint64_t> challenges(64);
+			for (auto& c : challenges) c = rng() % data_count;
+			SectorVerifier verifier(user_id, std::to_string(i), data_size,
+				roots[i]);
+			ok = verifier.VerifyPackedProofs(challenges,
+				provers[i]->GeneratePackedProofs(challenges, nullptr)) && ok;
+		}
+		assert(ok);
+		provers.clear();
+		fs::remove_all(path + "/batch");
+		fs::create_directories(path + "/batch");
+	}
+
+	// the whole data of every sector is mapped, a RAM budget is refused
+	SectorOptions options;
+	options.ram_budget = kSectorSizeM;
+	SectorProver prover(user_id, "budget", data_size, path + "/batch",
+		options);
+	bool refused = false;
+	try {
+		SectorBatchCreator creator({ &prover });
+	} catch (std::exception&) {
+		refused = true;
+	}
+	assert(refused);
+	(void)refused;
+	fs::remove_all(path);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "public.h"
+#include "sector_misc.h"
+
+class SectorProver;
+
+// Create several sectors of the same size on one core. A single InitData
+// chain is latency bound, so the chains of all sectors advance in lockstep:
+// item n of every sector per step, one multi-lane compression per step and
+// the random dy reads of all sectors in flight together. The data of every
+// sector is mapped whole, so SectorOptions::ram_budget is refused.
+class SectorBatchCreator : private boost::noncopyable {
+public:
+	// throw, also when a prover sets SectorOptions::ram_budget
+	explicit SectorBatchCreator(std::vector<SectorProver*> provers);
+
+	// long time
+	bool Create(SectorProgressCallback const& progress) noexcept;
+private:
+	void InitData(SectorProgressCallback const& progress); // throw, sync, long time
+	bool CheckSpace() noexcept;
+	void Remove() noexcept;
+private:
+	std::vector<SectorProver*> const provers_;
+};
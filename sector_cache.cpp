@@ -0,0 +1,345 @@
+#include "sector_cache.h"
+#include "sector_stripe.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#endif
+
+namespace {
+
+#if defined(__linux__)
+void* AllocPages(uint64_t size) {
+	void* p = nullptr;
+	if (posix_memalign(&p, SectorItemCache::kPageSize, size) != 0)
+		throw std::runtime_error("cache alloc");
+	return p;
+}
+#endif
+
+double Seconds(std::chrono::steady_clock::time_point begin) {
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - begin).count();
+}
+
+} // namespace
+
+bool SectorItemCache::Supported(uint64_t block_size) noexcept {
+#if defined(__linux__)
+	// checkpoints and resumes start on block ends, writes on page ends
+	return block_size * sizeof(SectorItem) % kPageSize == 0;
+#else
+	(void)block_size;
+	return false;
+#endif
+}
+
+// throw
+SectorItemCache::SectorItemCache(std::vector<std::string> const& pathnames,
+	uint64_t data_size, uint64_t stripe_size, uint64_t ram_budget,
+	uint64_t first, bool create)
+	: data_size_(data_size)
+	, stripe_size_(pathnames.size() == 1 ? data_size : stripe_size)
+	, ring_(nullptr, free)
+	, pages_(nullptr, free) {
+#if defined(__linux__)
+	uint64_t const kMinBudget = 4 * 1024 * 1024;
+	if (ram_budget < kMinBudget)
+		throw std::runtime_error("ram_budget too small");
+
+	// an eighth for each half of the tail, 2^x so halves never cross a
+	// stripe or the end, the rest for the cache
+	uint64_t half_size = 1024 * 1024;
+	while (half_size * 2 <= ram_budget / 8 && half_size * 2 <= data_size / 2 &&
+		half_size < 256 * 1024 * 1024) {
+		half_size *= 2;
+	}
+	half_size = std::min(half_size, data_size / 2);
+	half_count_ = half_size / sizeof(SectorItem);
+	ring_mask_ = half_count_ * 2 - 1;
+	ring_.reset((SectorItem*)AllocPages(half_size * 2));
+
+	uint64_t slot_count = (ram_budget - half_size * 2) / kPageSize;
+	pages_.reset((SectorItem*)AllocPages(slot_count * kPageSize));
+	tags_.assign(slot_count, UINT64_MAX);
+
+	try {
+		for (size_t i = 0; i < pathnames.size(); ++i) {
+			File file;
+			int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0);
+			file.fd = open(pathnames[i].c_str(), flags | O_DIRECT, 0644);
+			file.direct = file.fd >= 0;
+			if (file.fd < 0) // tmpfs and some others
+				file.fd = open(pathnames[i].c_str(), flags, 0644);
+			if (file.fd < 0)
+				throw std::runtime_error("open " + pathnames[i]);
+			files_.push_back(file);
+
+			uint64_t size = SectorStripedView::FileSize(data_size, stripe_size,
+				pathnames.size(), i);
+			if (create && ftruncate(file.fd, (off_t)size) != 0)
+				throw std::runtime_error("data size");
+			if (lseek(file.fd, 0, SEEK_END) != (off_t)size)
+				throw std::runtime_error("data size");
+		}
+
+		// the tail starts on a half, the items of it made before are read back
+		ring_first_ = first & ~(half_count_ - 1);
+		ring_end_ = ring_first_ + half_count_;
+		if (first > ring_first_ && !ReadRange(ring_first_, first - ring_first_,
+			&ring_[ring_first_ & ring_mask_])) {
+			throw std::runtime_error("read tail");
+		}
+	} catch (std::exception&) {
+		for (auto const& file : files_) {
+			close(file.fd);
+		}
+		throw;
+	}
+#else
+	(void)pathnames;
+	(void)ram_budget;
+	(void)first;
+	(void)create;
+	throw std::runtime_error("ram_budget not supported");
+#endif
+}
+
+SectorItemCache::~SectorItemCache() {
+	WaitWrite();
+#if defined(__linux__)
+	for (auto const& file : files_) {
+		close(file.fd);
+	}
+#endif
+}
+
+SectorCacheStats const& SectorItemCache::stats() const noexcept {
+	return stats_;
+}
+
+std::atomic<uint64_t>& SectorItemCache::fail_write() noexcept {
+	static std::atomic<uint64_t> fail_write(UINT64_MAX);
+	return fail_write;
+}
+
+SectorItem& SectorItemCache::Get(uint64_t n) noexcept {
+	uint64_t const page_count = kPageSize / sizeof(SectorItem);
+	uint64_t page = n / page_count;
+	uint64_t slot = page % tags_.size();
+	SectorItem* items = &pages_[slot * page_count];
+	if (tags_[slot] == page) {
+		++stats_.hits;
+	} else {
+		++stats_.misses;
+		auto begin = std::chrono::steady_clock::now();
+		if (!ReadRange(page * page_count, page_count, items)) {
+			SUICIDE("read data");
+		}
+		stats_.read_stall_seconds += Seconds(begin);
+		tags_[slot] = page;
+	}
+	return items[n % page_count];
+}
+
+// The chain reached ring_end_: the half before it is complete and goes to
+// the disks, the other half is reused once its own write is done.
+void SectorItemCache::Advance() noexcept {
+	auto begin = std::chrono::steady_clock::now();
+	write_failed_ = !WaitWrite() || write_failed_;
+	stats_.write_stall_seconds += Seconds(begin);
+
+	uint64_t first = ring_end_ - half_count_;
+	uint64_t fail = first;
+	bool lost = fail_write().compare_exchange_strong(fail, UINT64_MAX);
+	writing_ = std::async(std::launch::async, [this, first, lost]() {
+		return !lost && WriteRange(first, half_count_);
+	});
+	ring_first_ = std::max(ring_first_, first);
+	ring_end_ += half_count_;
+}
+
+bool SectorItemCache::WaitWrite() noexcept {
+	if (!writing_.valid())
+		return true;
+	return writing_.get();
+}
+
+bool SectorItemCache::Sync(uint64_t n, uint64_t count) noexcept {
+	// the older halves are written or being written, the current one is
+	// written up to the page after n + count, the items after that are
+	// written again with their half
+	uint64_t const page_count = kPageSize / sizeof(SectorItem);
+	uint64_t first = ring_end_ - half_count_;
+	uint64_t last = (n + count + page_count - 1) & ~(page_count - 1);
+	// a failed write behind fails the Flush too, not only this checkpoint
+	write_failed_ = !WaitWrite() || write_failed_;
+	bool ok = !write_failed_;
+	if (last > first)
+		ok = WriteRange(first, last - first) && ok;
+#if defined(__linux__)
+	for (auto const& file : files_) {
+		ok = fdatasync(file.fd) == 0 && ok;
+	}
+#endif
+	return ok;
+}
+
+// throw
+void SectorItemCache::Flush() {
+	if (!WaitWrite() || write_failed_)
+		throw std::runtime_error("write data");
+	uint64_t first = ring_end_ - half_count_;
+	uint64_t last = std::min(ring_end_, data_size_ / sizeof(SectorItem));
+	if (last > first && !WriteRange(first, last - first))
+		throw std::runtime_error("write data");
+}
+
+bool SectorItemCache::WriteRange(uint64_t first, uint64_t count) noexcept {
+#if defined(__linux__)
+	char const* buf = (char const*)&ring_[first & ring_mask_];
+	uint64_t offset = first * sizeof(SectorItem);
+	uint64_t left = count * sizeof(SectorItem);
+	while (left) {
+		uint32_t file;
+		uint64_t file_offset;
+		SectorStripedView::Locate(offset, stripe_size_, files_.size(), &file,
+			&file_offset);
+		uint64_t size = std::min(left, stripe_size_ - offset % stripe_size_);
+		uint64_t done = 0;
+		while (done < size) {
+			ssize_t n = pwrite(files_[file].fd, buf + done, size - done,
+				(off_t)(file_offset + done));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			done += (uint64_t)n;
+		}
+		if (!files_[file].direct) {
+			// keep the page cache out of the budget
+			posix_fadvise(files_[file].fd, (off_t)file_offset, (off_t)size,
+				POSIX_FADV_DONTNEED);
+		}
+		stats_.bytes_written += size;
+		offset += size;
+		buf += size;
+		left -= size;
+	}
+	return true;
+#else
+	(void)first;
+	(void)count;
+	return false;
+#endif
+}
+
+bool SectorItemCache::ReadRange(uint64_t first, uint64_t count,
+	void* buf) noexcept {
+#if defined(__linux__)
+	char* p = (char*)buf;
+	uint64_t offset = first * sizeof(SectorItem);
+	uint64_t left = count * sizeof(SectorItem);
+	while (left) {
+		uint32_t file;
+		uint64_t file_offset;
+		SectorStripedView::Locate(offset, stripe_size_, files_.size(), &file,
+			&file_offset);
+		uint64_t size = std::min(left, stripe_size_ - offset % stripe_size_);
+		uint64_t done = 0;
+		while (done < size) {
+			ssize_t n = pread(files_[file].fd, p + done, size - done,
+				(off_t)(file_offset + done));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			done += (uint64_t)n;
+		}
+		stats_.bytes_read += size;
+		SectorMetrics::Add(kSectorBytesRead, size);
+		offset += size;
+		p += size;
+		left -= size;
+	}
+	return true;
+#else
+	(void)first;
+	(void)count;
+	(void)buf;
+	return false;
+#endif
+}
+
+// Items written through the ring over two striped files while older ones
+// are read back through the cache: every read gives the item written, the
+// files hold all items after Flush. A cache from the middle of a half reads
+// its tail back and writes from the half on.
+void test_item_cache() {
+	std::string const path = "./test_item_cache";
+	uint64_t const data_size = 16 * 1024 * 1024;
+	uint64_t const count = data_size / sizeof(SectorItem);
+	uint64_t const stripe_size = 64 * 1024;
+	uint64_t const ram_budget = 4 * 1024 * 1024;
+	if (!SectorItemCache::Supported(1024))
+		return;
+
+	fs::remove_all(path);
+	fs::create_directories(path);
+	std::vector<std::string> const pathnames{ path + "/0.dat",
+		path + "/1.dat" };
+	std::mt19937_64 rng(1);
+	bool ok = true;
+	{
+		SectorItemCache items(pathnames, data_size, stripe_size, ram_budget,
+			0, true);
+		for (uint64_t n = 0; n < count; ++n) {
+			items[n] = SectorItem(n);
+			uint64_t m = rng() % (n + 1);
+			ok = items[m] == SectorItem(m) && ok;
+		}
+		items.Flush();
+		SectorCacheStats const& stats = items.stats();
+		assert(stats.hits > 0 && stats.misses > 0);
+		assert(stats.bytes_read == stats.misses * SectorItemCache::kPageSize);
+		assert(stats.bytes_written == data_size);
+		(void)stats;
+	}
+	{
+		SectorStripedView items(pathnames, data_size, stripe_size,
+			SectorStripedView::kRead);
+		for (uint64_t n = 0; n < count; ++n) {
+			ok = items[n] == SectorItem(n) && ok;
+		}
+	}
+	assert(ok);
+
+	// the items from first on are made again, as n + 1. first is on a page
+	// as block ends are.
+	uint64_t const first = count / 2 + 1024;
+	{
+		SectorItemCache items(pathnames, data_size, stripe_size, ram_budget,
+			first, false);
+		for (uint64_t n = count / 2; n < first; ++n) {
+			ok = items[n] == SectorItem(n) && ok;
+		}
+		for (uint64_t n = first; n < count; ++n) {
+			items[n] = SectorItem(n + 1);
+			uint64_t m = rng() % (n + 1);
+			ok = items[m] == SectorItem(m < first ? m : m + 1) && ok;
+		}
+		items.Flush();
+		assert(items.stats().bytes_written == data_size / 2);
+	}
+	{
+		SectorStripedView items(pathnames, data_size, stripe_size,
+			SectorStripedView::kRead);
+		for (uint64_t n = 0; n < count; ++n) {
+			ok = items[n] == SectorItem(n < first ? n : n + 1) && ok;
+		}
+	}
+	assert(ok);
+	(void)ok;
+	fs::remove_all(path);
+}
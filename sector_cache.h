@@ -0,0 +1,83 @@
+#pragma once
+
+#include "public.h"
+#include "sector_misc.h"
+#include <future>
+
+// The item array of an InitData under a RAM budget, see
+// SectorOptions::ram_budget. The growing tail lives in a ring of two halves:
+// a full half is written behind in large sequential writes while the chain
+// fills the other. Older items, the random dy parents, are read a page at a
+// time through a direct-mapped cache. The files are opened with O_DIRECT
+// where the filesystem allows it, so neither the page cache nor its
+// writeback competes for the budget. Linux only.
+class SectorItemCache : private boost::noncopyable {
+public:
+	static uint64_t const kPageSize = 4096;
+
+	// whether a sector with these blocks can be made this way here
+	static bool Supported(uint64_t block_size) noexcept;
+
+	// throw, items from first on are written, the ones before are read from
+	// the files. create makes the files.
+	SectorItemCache(std::vector<std::string> const& pathnames,
+		uint64_t data_size, uint64_t stripe_size, uint64_t ram_budget,
+		uint64_t first, bool create);
+
+	// waits for the write behind, Flush first to see its errors
+	~SectorItemCache();
+
+	// The next item to write or any item before it. A cached item stays
+	// valid until the next cache access.
+	SectorItem& operator[](uint64_t n) noexcept {
+		if (n >= ring_first_) {
+			if (n >= ring_end_)
+				Advance();
+			return ring_[n & ring_mask_];
+		}
+		return Get(n);
+	}
+
+	// write items [n, n + count) and wait for the disks, for a checkpoint
+	bool Sync(uint64_t n, uint64_t count) noexcept;
+
+	// throw, write the tail once all items are made
+	void Flush();
+
+	SectorCacheStats const& stats() const noexcept;
+
+	// for the tests, the write behind of the half from this item fails
+	static std::atomic<uint64_t>& fail_write() noexcept;
+
+private:
+	struct File {
+		int fd = -1;
+		bool direct = false;
+	};
+
+	SectorItem& Get(uint64_t n) noexcept;
+	void Advance() noexcept;
+	bool WaitWrite() noexcept;
+	bool WriteRange(uint64_t first, uint64_t count) noexcept;
+	bool ReadRange(uint64_t first, uint64_t count, void* buf) noexcept;
+
+private:
+	std::vector<File> files_;
+	uint64_t const data_size_;
+	uint64_t const stripe_size_;
+
+	// ring of 2 * half_count_ items, holds [ring_first_, ring_end_)
+	std::unique_ptr<SectorItem[], void (*)(void*)> ring_;
+	uint64_t ring_mask_;
+	uint64_t half_count_;
+	uint64_t ring_first_;
+	uint64_t ring_end_;
+	std::future<bool> writing_; // the half before ring_end_ - half_count_
+	bool write_failed_ = false;
+
+	// page p is in slot p % tags_.size() when tags_[slot] == p
+	std::unique_ptr<SectorItem[], void (*)(void*)> pages_;
+	std::vector<uint64_t> tags_;
+
+	SectorCacheStats stats_;
+};
@@ -0,0 +1,393 @@
+#include "sector_io.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <thread>
+#define SECTOR_IO_URING
+#endif
+#endif
+
+#if defined(SECTOR_IO_URING)
+// the rings as mapped from the kernel
+struct SectorReader::Uring {
+	int fd = -1;
+	void* sq_ring = MAP_FAILED;
+	size_t sq_ring_size = 0;
+	void* cq_ring = MAP_FAILED;
+	size_t cq_ring_size = 0;
+	io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+	size_t sqes_size = 0;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	io_uring_cqe* cqes;
+
+	~Uring() {
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqes_size);
+		if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+			munmap(cq_ring, cq_ring_size);
+		if (sq_ring != MAP_FAILED)
+			munmap(sq_ring, sq_ring_size);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool Init(unsigned entries) {
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+		if (fd < 0)
+			return false;
+
+		sq_ring_size = params.sq_off.array +
+			params.sq_entries * sizeof(unsigned);
+		cq_ring_size = params.cq_off.cqes +
+			params.cq_entries * sizeof(io_uring_cqe);
+		bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single_mmap) {
+			sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+		}
+		sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sq_ring == MAP_FAILED)
+			return false;
+		if (single_mmap) {
+			cq_ring = sq_ring;
+		} else {
+			cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (cq_ring == MAP_FAILED)
+				return false;
+		}
+		sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			return false;
+
+		char* sq = (char*)sq_ring;
+		sq_head = (unsigned*)(sq + params.sq_off.head);
+		sq_tail = (unsigned*)(sq + params.sq_off.tail);
+		sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+		sq_entries = *(unsigned*)(sq + params.sq_off.ring_entries);
+		sq_array = (unsigned*)(sq + params.sq_off.array);
+		char* cq = (char*)cq_ring;
+		cq_head = (unsigned*)(cq + params.cq_off.head);
+		cq_tail = (unsigned*)(cq + params.cq_off.tail);
+		cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+		cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+		return true;
+	}
+
+	int Enter(unsigned to_submit, unsigned min_complete) {
+		return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			IORING_ENTER_GETEVENTS, nullptr, 0);
+	}
+};
+#else
+struct SectorReader::Uring {
+};
+#endif
+
+// throw
+SectorReader::SectorReader(std::string const& pathname, char const* view,
+	uint64_t size)
+	: SectorReader(std::vector<std::string>{ pathname },
+		std::vector<char const*>{ view }, std::vector<uint64_t>{ size }) {
+}
+
+// throw
+SectorReader::SectorReader(std::vector<std::string> const& pathnames,
+	std::vector<char const*> const& views, std::vector<uint64_t> const& sizes)
+	: views_(views)
+	, sizes_(sizes)
+	, fds_(pathnames.size(), -1)
+	, uring_ok_(false) {
+	if (views_.size() != fds_.size() || sizes_.size() != fds_.size())
+		throw std::runtime_error("reader files");
+
+	bool any_fd = false;
+	for (size_t i = 0; i < fds_.size(); ++i) {
+#if defined(__linux__)
+		fds_[i] = open(pathnames[i].c_str(), O_RDONLY | O_CLOEXEC);
+		any_fd = any_fd || fds_[i] >= 0;
+#endif
+		if (fds_[i] < 0 && !views_[i]) {
+			CloseAll();
+			throw std::runtime_error("open " + pathnames[i]);
+		}
+	}
+#if defined(SECTOR_IO_URING)
+	if (any_fd) {
+		std::unique_ptr<Uring> ring(new Uring);
+		if (ring->Init(kQueueDepth)) {
+			rings_.push_back(std::move(ring));
+			uring_ok_ = true;
+		} // else seccomp or an old kernel, pread then
+	}
+#endif
+	(void)any_fd;
+}
+
+SectorReader::~SectorReader() {
+	rings_.clear();
+	CloseAll();
+}
+
+void SectorReader::CloseAll() noexcept {
+#if defined(__linux__)
+	for (auto& fd : fds_) {
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+	}
+#endif
+}
+
+char const* SectorReader::backend() const noexcept {
+	if (uring_ok_)
+		return "io_uring";
+	for (auto fd : fds_) {
+		if (fd >= 0)
+			return "pread";
+	}
+	return "mmap";
+}
+
+bool SectorReader::Read(std::vector<SectorRead> const& reads) noexcept {
+	auto ring = TakeRing();
+	if (!ring)
+		return ReadEach(reads);
+	bool ok = ReadUring(ring, reads);
+	GiveRing(std::move(ring));
+	return ok;
+}
+
+std::unique_ptr<SectorReader::Uring> SectorReader::TakeRing() noexcept {
+	std::unique_ptr<Uring> ring;
+	if (!uring_ok_)
+		return ring;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!rings_.empty()) {
+			ring = std::move(rings_.back());
+			rings_.pop_back();
+			return ring;
+		}
+	}
+#if defined(SECTOR_IO_URING)
+	// all busy, e.g. concurrent proofs. A ring that cannot be made, say
+	// under RLIMIT_MEMLOCK, leaves this batch to pread.
+	ring.reset(new Uring);
+	if (!ring->Init(kQueueDepth))
+		ring.reset();
+#endif
+	return ring;
+}
+
+void SectorReader::GiveRing(std::unique_ptr<Uring> ring) noexcept {
+	if (!ring || !uring_ok_)
+		return;
+	std::lock_guard<std::mutex> lock(mutex_);
+	rings_.push_back(std::move(ring));
+}
+
+bool SectorReader::ReadEach(std::vector<SectorRead> const& reads) noexcept {
+	bool ok = true;
+	for (auto const& read : reads) {
+		ok = ReadOne(read) && ok;
+	}
+	return ok;
+}
+
+bool SectorReader::ReadOne(SectorRead const& read) noexcept {
+	if (read.file >= fds_.size())
+		return false;
+#if defined(__linux__)
+	int fd = fds_[read.file];
+	if (fd >= 0) {
+		uint32_t done = 0;
+		while (done < read.size) {
+			ssize_t n = pread(fd, (char*)read.buf + done, read.size - done,
+				(off_t)(read.offset + done));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			done += (uint32_t)n;
+		}
+		if (done == read.size)
+			return true;
+	}
+#endif
+	char const* view = views_[read.file];
+	if (!view || read.offset + read.size > sizes_[read.file])
+		return false;
+	memcpy(read.buf, view + read.offset, read.size);
+	return true;
+}
+
+#if defined(SECTOR_IO_URING)
+bool SectorReader::ReadUring(std::unique_ptr<Uring>& uring,
+	std::vector<SectorRead> const& reads) noexcept {
+	auto& ring = *uring;
+	bool ok = true;
+	size_t next = 0;
+	unsigned inflight = 0;
+	unsigned queued = 0; // in the ring, not yet taken by the kernel
+	auto reap = [&]() {
+		unsigned cq_head = *ring.cq_head;
+		unsigned cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (; cq_head != cq_tail; ++cq_head) {
+			io_uring_cqe const& cqe = ring.cqes[cq_head & ring.cq_mask];
+			auto const& read = reads[(size_t)cqe.user_data];
+			// errors and short reads, e.g. no IORING_OP_READ before 5.6
+			if (cqe.res != (int)read.size)
+				ok = ReadOne(read) && ok;
+			--inflight;
+		}
+		__atomic_store_n(ring.cq_head, cq_head, __ATOMIC_RELEASE);
+	};
+
+	while (next < reads.size() || inflight > 0 || queued > 0) {
+		// queue as many reads as the ring takes
+		unsigned tail = *ring.sq_tail;
+		unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+		unsigned to_submit = queued;
+		while (next < reads.size() && inflight + to_submit < kQueueDepth &&
+			tail - head < ring.sq_entries) {
+			auto const& read = reads[next];
+			if (read.file >= fds_.size() || fds_[read.file] < 0) {
+				ok = ReadOne(read) && ok; // served from the view
+				++next;
+				continue;
+			}
+			unsigned index = tail & ring.sq_mask;
+			io_uring_sqe* sqe = &ring.sqes[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = fds_[read.file];
+			sqe->addr = (uint64_t)(uintptr_t)read.buf;
+			sqe->len = read.size;
+			sqe->off = read.offset;
+			sqe->user_data = next;
+			ring.sq_array[index] = index;
+			++tail;
+			++next;
+			++to_submit;
+		}
+		__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+		if (to_submit == 0 && inflight == 0)
+			continue; // nothing to wait for
+
+		int ret = ring.Enter(to_submit, 1);
+		if (ret < 0 && errno != EINTR) {
+			// The ring is unusable, the batch is served the slow way. The
+			// reads the kernel took still write into the caller's buffers:
+			// wait for every one of them before the ring and the buffers go.
+			// The kernel posts them whether or not Enter works. The other
+			// rings finish their batches and are dropped when given back.
+			uring_ok_ = false;
+			while (inflight > 0) {
+				if (ring.Enter(0, 1) < 0 && errno != EINTR)
+					std::this_thread::yield();
+				reap();
+			}
+			uring.reset();
+			return ReadEach(reads);
+		}
+		unsigned submitted = ret > 0 ? (unsigned)ret : 0;
+		inflight += submitted;
+		queued = to_submit - submitted;
+		reap();
+	}
+	return ok;
+}
+#else
+bool SectorReader::ReadUring(std::unique_ptr<Uring>& uring,
+	std::vector<SectorRead> const& reads) noexcept {
+	uring.reset();
+	return ReadEach(reads);
+}
+#endif
+
+bool SyncMapped(void const* addr, uint64_t size) noexcept {
+	if (!size)
+		return true;
+#if defined(_WIN32)
+	return FlushViewOfFile(addr, (SIZE_T)size) != 0;
+#elif defined(__linux__)
+	uintptr_t const page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t begin = (uintptr_t)addr & ~(page - 1);
+	uintptr_t end = (uintptr_t)addr + size;
+	return msync((void*)begin, end - begin, MS_SYNC) == 0;
+#else
+	(void)addr;
+	return false;
+#endif
+}
+
+bool WriteFileDurable(std::string const& pathname, void const* data,
+	size_t size) noexcept {
+	std::string temp_pathname = pathname + ".tmp";
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(temp_pathname.c_str(), GENERIC_WRITE, 0, nullptr,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD written = 0;
+	bool ok = WriteFile(file, data, (DWORD)size, &written, nullptr) &&
+		written == size && FlushFileBuffers(file);
+	CloseHandle(file);
+	return ok && MoveFileExA(temp_pathname.c_str(), pathname.c_str(),
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#elif defined(__linux__)
+	int fd = open(temp_pathname.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+		O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = write(fd, (char const*)data + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += (size_t)n;
+	}
+	bool ok = done == size && fsync(fd) == 0;
+	close(fd);
+	if (!ok || rename(temp_pathname.c_str(), pathname.c_str()) != 0)
+		return false;
+
+	// the rename itself must survive too
+	std::string dir = pathname.substr(0, pathname.find_last_of('/') + 1);
+	int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_CLOEXEC);
+	if (dir_fd < 0)
+		return false;
+	ok = fsync(dir_fd) == 0;
+	close(dir_fd);
+	return ok;
+#else
+	(void)data;
+	(void)size;
+	(void)temp_pathname;
+	return false;
+#endif
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "public.h"
+#include <mutex>
+
+// one read of a batch: size bytes at offset of file into buf
+struct SectorRead {
+	uint64_t offset;
+	void* buf;
+	uint32_t size;
+	uint32_t file = 0; // index into the reader's files
+};
+
+// Random reads of a sector file, served as one batch. On Linux the batch
+// goes through io_uring with up to kQueueDepth reads in flight (raw
+// syscalls, no liburing), pread covers kernels without it and short reads.
+// Elsewhere, or when a read fails, the bytes are copied from the mapped
+// view, where a page fault would have read them before. Read may be called
+// from many threads at once: each call takes an idle ring to itself, a new
+// one when all are busy, so no batch waits for another.
+class SectorReader : private boost::noncopyable {
+public:
+	static unsigned const kQueueDepth = 128;
+
+	// throw, view of the whole file may be null
+	SectorReader(std::string const& pathname, char const* view, uint64_t size);
+
+	// throw, several files served by one ring, e.g. the stripes of a sector
+	SectorReader(std::vector<std::string> const& pathnames,
+		std::vector<char const*> const& views,
+		std::vector<uint64_t> const& sizes);
+
+	~SectorReader();
+
+	// false if some read could not be served
+	bool Read(std::vector<SectorRead> const& reads) noexcept;
+
+	// "io_uring", "pread" or "mmap"
+	char const* backend() const noexcept;
+
+private:
+	struct Uring;
+
+	std::unique_ptr<Uring> TakeRing() noexcept; // null for pread
+	void GiveRing(std::unique_ptr<Uring> ring) noexcept;
+	// ring is reset when it failed, the batch is then read the slow way
+	bool ReadUring(std::unique_ptr<Uring>& ring,
+		std::vector<SectorRead> const& reads) noexcept;
+	bool ReadEach(std::vector<SectorRead> const& reads) noexcept;
+	bool ReadOne(SectorRead const& read) noexcept;
+	void CloseAll() noexcept;
+
+private:
+	std::vector<char const*> const views_;
+	std::vector<uint64_t> const sizes_;
+	std::vector<int> fds_;
+	std::atomic<bool> uring_ok_; // false once a ring failed
+	std::mutex mutex_; // guards rings_
+	std::vector<std::unique_ptr<Uring>> rings_; // idle
+};
+
+// Write back the dirty pages of [addr, addr + size) of a mapped file and
+// wait for the disk, the range need not be page aligned.
+bool SyncMapped(void const* addr, uint64_t size) noexcept;
+
+// Replace pathname with the bytes as one durable step: a crash leaves the
+// old content or the new one, never a torn file.
+bool WriteFileDurable(std::string const& pathname, void const* data,
+	size_t size) noexcept;
@@ -0,0 +1,539 @@
+#include "sector_manager.h"
+#include "sector_prover.h"
+#include "sector_verifier.h"
+#include "sector_io.h"
+#include "tick.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#endif
+
+namespace {
+
+char const* const kRegistryMagic = "pos-sectors";
+int const kRegistryVersion = 1;
+
+char const* const kStateNames[] = { "queued", "creating", "ready", "failed" };
+
+std::string ToHex(SectorItem const& item) {
+	std::ostringstream out;
+	for (auto i : item.data) {
+		out << std::hex << std::setw(8) << std::setfill('0') << i;
+	}
+	return out.str();
+}
+
+// throw
+SectorItem FromHex(std::string const& hex) {
+	if (hex.size() != 64)
+		throw std::runtime_error("registry root");
+	SectorItem item;
+	for (size_t i = 0; i < 8; ++i) {
+		item.data[i] = (uint32_t)std::stoul(hex.substr(i * 8, 8), nullptr, 16);
+	}
+	return item;
+}
+
+std::vector<std::string> Split(std::string const& line, char separator) {
+	std::vector<std::string> fields;
+	size_t begin = 0;
+	for (;;) {
+		size_t end = line.find(separator, begin);
+		fields.push_back(line.substr(begin, end - begin));
+		if (end == std::string::npos)
+			return fields;
+		begin = end + 1;
+	}
+}
+
+size_t ThreadCount(size_t thread_count) {
+	if (thread_count == 0)
+		thread_count = std::thread::hardware_concurrency();
+	return std::max<size_t>(thread_count, 1);
+}
+
+} // namespace
+
+// throw
+SectorManager::SectorManager(std::string user_id,
+	std::string registry_pathname, SectorManagerOptions const& options)
+	: user_id_(std::move(user_id))
+	, registry_pathname_(std::move(registry_pathname))
+	, options_(options) {
+	if (!options_.sector_options.stripe_paths.empty())
+		throw std::runtime_error("stripe_paths not supported");
+	if (options_.jobs_per_disk == 0)
+		throw std::runtime_error("invalid jobs_per_disk");
+	LoadRegistry();
+
+	for (size_t i = 0; i < ThreadCount(options_.create_thread_count); ++i) {
+		create_threads_.emplace_back([this]() { CreateMain(); });
+	}
+	for (size_t i = 0; i < ThreadCount(options_.prove_thread_count); ++i) {
+		prove_threads_.emplace_back([this]() { ProveMain(); });
+	}
+}
+
+SectorManager::~SectorManager() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	create_cv_.notify_all();
+	prove_cv_.notify_all();
+	for (auto& thread : create_threads_) {
+		thread.join();
+	}
+	for (auto& thread : prove_threads_) {
+		thread.join();
+	}
+}
+
+std::shared_ptr<SectorManager::Sector> SectorManager::NewSector(
+	SectorRecord const& record) const {
+	auto sector = std::make_shared<Sector>();
+	sector->record = record;
+	if (sector->record.tree_path.empty())
+		sector->record.tree_path = sector->record.meta_path;
+	sector->disks.push_back(DiskOf(record.data_path));
+
+	auto const& sector_options = options_.sector_options;
+	if (sector_options.in_memory) {
+		sector->ram = record.data_size;
+	} else {
+		sector->ram = sector_options.ram_budget;
+	}
+	return sector;
+}
+
+bool SectorManager::Add(std::string const& sector_id, uint64_t data_size,
+	std::string const& data_path, std::string const& meta_path,
+	std::string const& tree_path) noexcept {
+	SectorRecord record;
+	record.sector_id = sector_id;
+	record.data_size = data_size;
+	record.data_path = data_path;
+	record.meta_path = meta_path;
+	record.tree_path = tree_path;
+	auto sector = NewSector(record);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!sectors_.emplace(sector_id, sector).second)
+			return false;
+		if (!SaveRegistry()) {
+			sectors_.erase(sector_id);
+			return false;
+		}
+		queue_.push_back(sector);
+	}
+	create_cv_.notify_one();
+	return true;
+}
+
+void SectorManager::Wait() noexcept {
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_cv_.wait(lock, [this]() { return queue_.empty() && running_ == 0; });
+}
+
+std::vector<SectorRecord> SectorManager::records() noexcept {
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<SectorRecord> ret;
+	for (auto const& sector : sectors_) {
+		ret.push_back(sector.second->record);
+	}
+	return ret;
+}
+
+// The first queued sector whose data disks have a free slot and whose RAM
+// fits. A sector larger than the whole budget runs alone.
+std::shared_ptr<SectorManager::Sector> SectorManager::TakeRunnable() noexcept {
+	for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+		auto const& sector = *it;
+		bool disks_free = true;
+		for (auto const& disk : sector->disks) {
+			disks_free = disks_free && disk_jobs_[disk] < options_.jobs_per_disk;
+		}
+		bool ram_fits = options_.ram_budget == 0 || running_ == 0 ||
+			ram_used_ + sector->ram <= options_.ram_budget;
+		if (disks_free && ram_fits) {
+			auto ret = sector;
+			queue_.erase(it);
+			return ret;
+		}
+	}
+	return nullptr;
+}
+
+void SectorManager::CreateMain() noexcept {
+	for (;;) {
+		std::shared_ptr<Sector> sector;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			while (!stop_ && !(sector = TakeRunnable())) {
+				create_cv_.wait(lock);
+			}
+			if (!sector)
+				return;
+			for (auto const& disk : sector->disks) {
+				++disk_jobs_[disk];
+			}
+			ram_used_ += sector->ram;
+			++running_;
+			sector->record.state = SectorRecord::kCreating;
+			SaveRegistry();
+		}
+
+		bool ok = RunCreate(*sector);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (auto const& disk : sector->disks) {
+				--disk_jobs_[disk];
+			}
+			ram_used_ -= sector->ram;
+			--running_;
+			sector->record.state = ok ? SectorRecord::kReady :
+				SectorRecord::kFailed;
+			SaveRegistry();
+		}
+		create_cv_.notify_all();
+		idle_cv_.notify_all();
+	}
+}
+
+// long time, a sector found unfinished in the registry is resumed from its
+// checkpoint if it has one
+bool SectorManager::RunCreate(Sector& sector) noexcept {
+	SectorRecord const& record = sector.record; // only this thread writes it
+	std::unique_ptr<SectorProver> prover;
+	try {
+		prover.reset(new SectorProver(user_id_, record.sector_id,
+			record.data_size, record.data_path, record.meta_path,
+			record.tree_path, options_.sector_options));
+	} catch (std::exception&) {
+		return false;
+	}
+
+	auto progress = [](int, std::string) {};
+	bool ok = sector.resume && prover->Resume(progress);
+	if (!ok)
+		ok = prover->Create(progress);
+	if (!ok)
+		return false;
+
+	SectorItem root = prover->mkl_root();
+	if (options_.sector_options.in_memory) {
+		// written out before it is ready, so a restart finds its data. Its
+		// RAM goes with the prover, the proofs open the files, see RunProve
+		if (!prover->Persist(progress))
+			return false;
+		prover.reset();
+	}
+	{
+		std::lock_guard<std::mutex> lock(sector.mutex);
+		sector.prover = std::move(prover);
+	}
+	std::lock_guard<std::mutex> lock(mutex_);
+	sector.record.mkl_root = root;
+	return true;
+}
+
+std::future<std::vector<char>> SectorManager::Prove(
+	std::string const& sector_id, std::vector<uint64_t> challenges) noexcept {
+	auto promise = std::make_shared<std::promise<std::vector<char>>>();
+	auto future = promise->get_future();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto it = sectors_.find(sector_id);
+		if (it != sectors_.end() && !challenges.empty() &&
+			it->second->record.state == SectorRecord::kReady) {
+			ProveJob job;
+			job.sector = it->second;
+			job.challenges = std::move(challenges);
+			job.promise = promise;
+			prove_jobs_.push_back(std::move(job));
+			prove_cv_.notify_one();
+			return future;
+		}
+	}
+	promise->set_value(std::vector<char>());
+	return future;
+}
+
+void SectorManager::ProveMain() noexcept {
+	for (;;) {
+		ProveJob job;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			prove_cv_.wait(lock, [this]() {
+				return stop_ || !prove_jobs_.empty();
+			});
+			if (prove_jobs_.empty())
+				return;
+			job = std::move(prove_jobs_.front());
+			prove_jobs_.pop_front();
+		}
+		job.promise->set_value(RunProve(*job.sector, job.challenges));
+	}
+}
+
+std::vector<char> SectorManager::RunProve(Sector& sector,
+	std::vector<uint64_t> const& challenges) noexcept {
+	// only the first proofs of a sector wait for its Open, later batches of
+	// it run at once, see SectorProver::GenerateProofs
+	std::unique_lock<std::mutex> lock(sector.mutex);
+	if (!sector.prover) {
+		SectorRecord const& record = sector.record; // kReady, no more writes
+		// mapped, an in_memory prover would keep the whole data resident
+		SectorOptions sector_options = options_.sector_options;
+		sector_options.in_memory = false;
+		try {
+			std::unique_ptr<SectorProver> prover(new SectorProver(user_id_,
+				record.sector_id, record.data_size, record.data_path,
+				record.meta_path, record.tree_path, sector_options));
+			if (!prover->Open(SectorProver::FastIntegrityCheck) ||
+				prover->mkl_root() != record.mkl_root) {
+				return std::vector<char>();
+			}
+			sector.prover = std::move(prover);
+		} catch (std::exception&) {
+			return std::vector<char>();
+		}
+	}
+	SectorProver& prover = *sector.prover; // kept until the manager goes
+	lock.unlock();
+	return prover.GeneratePackedProofs(challenges, nullptr);
+}
+
+// throw
+void SectorManager::LoadRegistry() {
+	std::error_code error_code;
+	if (!fs::exists(registry_pathname_, error_code))
+		return;
+
+	std::ifstream in(registry_pathname_);
+	std::string line;
+	if (!in || !std::getline(in, line))
+		throw std::runtime_error("registry read");
+	auto header = Split(line, '\t');
+	if (header.size() != 3 || header[0] != kRegistryMagic ||
+		header[1] != std::to_string(kRegistryVersion)) {
+		throw std::runtime_error("registry format");
+	}
+	if (header[2] != user_id_)
+		throw std::runtime_error("registry of another user");
+
+	// sector_id, data_size, state, root, data_path, meta_path, tree_path
+	while (std::getline(in, line)) {
+		if (line.empty())
+			continue;
+		auto fields = Split(line, '\t');
+		if (fields.size() != 7)
+			throw std::runtime_error("registry format");
+		SectorRecord record;
+		record.sector_id = fields[0];
+		record.data_size = std::stoull(fields[1]);
+		auto state = std::find(std::begin(kStateNames), std::end(kStateNames),
+			fields[2]);
+		if (state == std::end(kStateNames))
+			throw std::runtime_error("registry state");
+		record.state = (SectorRecord::State)(state - std::begin(kStateNames));
+		record.mkl_root = FromHex(fields[3]);
+		record.data_path = fields[4];
+		record.meta_path = fields[5];
+		record.tree_path = fields[6];
+
+		auto sector = NewSector(record);
+		if (!sectors_.emplace(record.sector_id, sector).second)
+			throw std::runtime_error("registry duplicate");
+		if (record.state == SectorRecord::kQueued ||
+			record.state == SectorRecord::kCreating) {
+			// cut short by the last stop
+			sector->resume = record.state == SectorRecord::kCreating;
+			sector->record.state = SectorRecord::kQueued;
+			queue_.push_back(sector);
+		}
+	}
+}
+
+// under mutex_, the file is replaced at once
+bool SectorManager::SaveRegistry() noexcept {
+	std::ostringstream out;
+	out << kRegistryMagic << '\t' << kRegistryVersion << '\t' << user_id_ <<
+		'\n';
+	for (auto const& it : sectors_) {
+		auto const& record = it.second->record;
+		out << record.sector_id << '\t' << record.data_size << '\t' <<
+			kStateNames[record.state] << '\t' << ToHex(record.mkl_root) <<
+			'\t' << record.data_path << '\t' << record.meta_path << '\t' <<
+			record.tree_path << '\n';
+	}
+	std::string text = out.str();
+	return WriteFileDurable(registry_pathname_, text.data(), text.size());
+}
+
+std::string SectorManager::DiskOf(std::string const& path) noexcept {
+#if defined(_WIN32)
+	char volume[MAX_PATH];
+	if (GetVolumePathNameA(path.c_str(), volume, MAX_PATH))
+		return volume;
+	return path;
+#elif defined(__linux__)
+	// a directory made later is on the disk of its nearest parent
+	fs::path existing(path);
+	struct stat st;
+	while (stat(existing.empty() ? "." : existing.c_str(), &st) != 0) {
+		if (existing.empty() || existing == existing.root_path())
+			return path;
+		existing = existing.parent_path();
+	}
+	std::string dev = std::to_string(major(st.st_dev)) + ":" +
+		std::to_string(minor(st.st_dev));
+	char real[PATH_MAX];
+	if (!realpath(("/sys/dev/block/" + dev).c_str(), real))
+		return "dev " + dev; // tmpfs, overlay and the like
+	std::string disk = real;
+	// a partition is a directory in the one of its disk
+	if (access((disk + "/partition").c_str(), F_OK) == 0)
+		disk = disk.substr(0, disk.rfind('/'));
+	return disk.substr(disk.rfind('/') + 1);
+#else
+	return path;
+#endif
+}
+
+namespace {
+
+// the most Creates at once, in all and per data path, until none is queued
+// or running
+struct CreatePeaks {
+	size_t total = 0;
+	std::map<std::string, size_t> paths;
+};
+
+CreatePeaks WatchCreates(SectorManager& manager) {
+	CreatePeaks peaks;
+	for (;;) {
+		size_t total = 0, done = 0;
+		std::map<std::string, size_t> paths;
+		auto records = manager.records();
+		for (auto const& record : records) {
+			if (record.state == SectorRecord::kCreating) {
+				++total;
+				++paths[record.data_path];
+			} else if (record.state != SectorRecord::kQueued) {
+				++done;
+			}
+		}
+		peaks.total = std::max(peaks.total, total);
+		for (auto const& path : paths) {
+			peaks.paths[path.first] = std::max(peaks.paths[path.first],
+				path.second);
+		}
+		if (done == records.size())
+			return peaks;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+// a new manager on the registry proves every sector, all must verify
+void ProveAll(std::string const& user_id, std::string const& registry_pathname,
+	SectorManagerOptions const& options, size_t sector_count) {
+	SectorManager manager(user_id, registry_pathname, options);
+	auto records = manager.records();
+	assert(records.size() == sector_count);
+	(void)sector_count;
+	std::vector<std::future<std::vector<char>>> futures;
+	std::vector<std::vector<uint64_t>> challenges;
+	std::mt19937_64 rng(1);
+	for (auto const& record : records) {
+		assert(record.state == SectorRecord::kReady);
+		std::vector<uint64_t> c(64);
+		for (auto& i : c) i = rng() % (record.data_size / SHA256_DIGESTSIZE);
+		futures.push_back(manager.Prove(record.sector_id, c));
+		challenges.push_back(c);
+	}
+	assert(manager.Prove("unknown", challenges[0]).get().empty());
+	for (size_t i = 0; i < records.size(); ++i) {
+		SectorVerifier verifier(user_id, records[i].sector_id,
+			records[i].data_size, records[i].mkl_root);
+		bool ok = verifier.VerifyPackedProofs(challenges[i], futures[i].get());
+		assert(ok);
+		(void)ok;
+	}
+}
+
+} // namespace
+
+// Two data paths, on two disks where /dev/shm is a tmpfs. One Create a
+// disk: the first sector of the second path starts beside the first one of
+// the first path, ahead of the queued sectors that wait for that disk.
+// Then the RAM budget alone holds in_memory Creates to one at a time, and
+// their sectors must still prove after a restart.
+void test_sector_manager() {
+	std::string const path = "./test_sector_manager";
+	std::string other = path + "/b";
+#if defined(__linux__)
+	if (fs::exists("/dev/shm"))
+		other = "/dev/shm/test_sector_manager";
+#endif
+	std::string const user_id = "abcd";
+	uint64_t const data_size = 16 * kSectorSizeM;
+	size_t const kSectors = 6;
+
+	for (bool in_memory : { false, true }) {
+		fs::remove_all(path);
+		fs::remove_all(other);
+		// the disks are known before the directories are made
+		std::string const disk = SectorManager::DiskOf(path);
+		std::string const other_disk = SectorManager::DiskOf(other);
+		fs::create_directories(path);
+		fs::create_directories(other);
+		assert(SectorManager::DiskOf(path) == disk);
+		assert(SectorManager::DiskOf(other) == other_disk);
+		assert(SectorManager::DiskOf(path + "/not/yet") == disk);
+		bool const two_disks = disk != other_disk;
+		std::string const registry_pathname = path + "/sectors.reg";
+
+		SectorManagerOptions options;
+		options.create_thread_count = 4;
+		options.sector_options.checkpoint_seconds = 0;
+		if (in_memory) {
+			options.jobs_per_disk = 2;
+			options.ram_budget = data_size * 3 / 2;
+			options.sector_options.in_memory = true;
+		}
+		{
+			SectorManager manager(user_id, registry_pathname, options);
+			for (size_t i = 0; i < kSectors; ++i) {
+				std::string const& data_path = i < kSectors / 2 ? path : other;
+				bool ok = manager.Add(std::to_string(i), data_size, data_path,
+					data_path);
+				assert(ok);
+				(void)ok;
+			}
+			assert(!manager.Add("0", data_size, path, path));
+			CreatePeaks peaks = WatchCreates(manager);
+			manager.Wait();
+
+			if (in_memory) {
+				assert(peaks.total == 1);
+			} else if (two_disks) {
+				assert(peaks.paths[path] == 1 && peaks.paths[other] == 1);
+				assert(peaks.total == 2);
+			} else {
+				assert(peaks.total == 1);
+			}
+		}
+		// the registry brings the roots back, the sectors open on demand
+		ProveAll(user_id, registry_pathname, options, kSectors);
+	}
+	fs::remove_all(path);
+	fs::remove_all(other);
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "public.h"
+#include "sector_misc.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <future>
+
+class SectorProver;
+
+// what the manager keeps of a sector, see SectorManager::records
+struct SectorRecord {
+	enum State {
+		kQueued,
+		kCreating,
+		kReady,
+		kFailed,
+	};
+
+	std::string sector_id;
+	uint64_t data_size = 0;
+	std::string data_path;
+	std::string meta_path;
+	std::string tree_path;
+	State state = kQueued;
+	SectorItem mkl_root = SectorItem((uint64_t)0); // once kReady
+};
+
+struct SectorManagerOptions {
+	// Creates at once, the CPU budget: the chain of a sector runs on one
+	// core. 0 means one per core.
+	size_t create_thread_count = 0;
+
+	// threads serving Prove, 0 means one per core
+	size_t prove_thread_count = 0;
+
+	// RAM for all Creates in flight. A sector costs its data_size when
+	// in_memory, its ram_budget when set, else nothing: the mapped data is
+	// left to the page cache. 0 means no limit.
+	uint64_t ram_budget = 0;
+
+	// Creates writing their data to one disk at once, 1 keeps two chains
+	// from seeking against each other
+	uint32_t jobs_per_disk = 1;
+
+	// of every sector, stripe_paths is not supported here. An in_memory
+	// sector is persisted before it is ready and proved from its files, so
+	// its RAM is held only while it is created.
+	SectorOptions sector_options;
+};
+
+// Owns the sectors of a user on a host. Added sectors are created in the
+// background under the budgets of SectorManagerOptions: a queued sector
+// whose data disk is busy waits, while the ones behind it on free disks go
+// first. The roots and paths are kept in a registry file, so a restart
+// finds the ready sectors and resumes the unfinished ones. Proofs of many
+// sectors, and many batches of one, are generated at once, a sector is
+// opened on its first proof.
+class SectorManager : private boost::noncopyable {
+public:
+	// throw, reads the registry when it exists
+	SectorManager(std::string user_id, std::string registry_pathname,
+		SectorManagerOptions const& options = SectorManagerOptions());
+
+	// waits for the running Creates and the queued proofs, the queued
+	// Creates stay in the registry for the next start
+	~SectorManager();
+
+	// queue the Create of a new sector, false if the id is known or the
+	// registry could not be written. An empty tree_path means meta_path.
+	bool Add(std::string const& sector_id, uint64_t data_size,
+		std::string const& data_path, std::string const& meta_path,
+		std::string const& tree_path = "") noexcept;
+
+	// until no Create is queued or running
+	void Wait() noexcept;
+
+	std::vector<SectorRecord> records() noexcept;
+
+	// packed proofs of the sector, see SectorProver::GeneratePackedProofs.
+	// Empty when the sector is not ready or cannot be opened.
+	std::future<std::vector<char>> Prove(std::string const& sector_id,
+		std::vector<uint64_t> challenges) noexcept;
+
+	// The disk under path, or under its nearest existing parent, e.g. "sda"
+	// for a partition of it on Linux, the volume on Windows. An LVM or md
+	// volume counts as one disk.
+	static std::string DiskOf(std::string const& path) noexcept;
+
+private:
+	struct Sector {
+		SectorRecord record; // guarded by mutex_
+		std::vector<std::string> disks; // of the data
+		uint64_t ram = 0;
+		bool resume = false; // found kCreating in the registry
+
+		std::mutex mutex; // guards prover until it is set, it stays then
+		std::unique_ptr<SectorProver> prover;
+	};
+
+	struct ProveJob {
+		std::shared_ptr<Sector> sector;
+		std::vector<uint64_t> challenges;
+		std::shared_ptr<std::promise<std::vector<char>>> promise;
+	};
+
+	std::shared_ptr<Sector> NewSector(SectorRecord const& record) const;
+	std::shared_ptr<Sector> TakeRunnable() noexcept;
+	void CreateMain() noexcept;
+	bool RunCreate(Sector& sector) noexcept;
+	void ProveMain() noexcept;
+	std::vector<char> RunProve(Sector& sector,
+		std::vector<uint64_t> const& challenges) noexcept;
+	void LoadRegistry(); // throw
+	bool SaveRegistry() noexcept;
+
+private:
+	std::string const user_id_;
+	std::string const registry_pathname_;
+	SectorManagerOptions const options_;
+
+	std::mutex mutex_;
+	std::condition_variable create_cv_;
+	std::condition_variable prove_cv_;
+	std::condition_variable idle_cv_;
+	std::map<std::string, std::shared_ptr<Sector>> sectors_; // by id
+	std::deque<std::shared_ptr<Sector>> queue_; // to create, in Add order
+	std::map<std::string, uint32_t> disk_jobs_; // Creates per disk
+	uint64_t ram_used_ = 0;
+	size_t running_ = 0;
+	std::deque<ProveJob> prove_jobs_;
+	bool stop_ = false;
+
+	std::vector<std::thread> create_threads_;
+	std::vector<std::thread> prove_threads_;
+};
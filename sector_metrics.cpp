@@ -0,0 +1,329 @@
+#include "sector_metrics.h"
+#include "sector_io.h"
+#include <mutex>
+#include <sstream>
+#include <iomanip>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+char const* const kCounterNames[kSectorCounterCount] = {
+	"hashes",
+	"items_created",
+	"bytes_read",
+	"bytes_written",
+	"proofs_generated",
+	"proofs_verified",
+};
+
+// upper bounds in seconds, the last bucket is +Inf
+double const kBounds[] = { 0.0001, 0.001, 0.01, 0.1, 1, 10, 100, 1000, 10000 };
+size_t const kBucketCount = SectorMetrics::kBucketCount;
+static_assert(sizeof(kBounds) / sizeof(kBounds[0]) + 1 == kBucketCount,
+	"buckets");
+
+struct Histogram {
+	uint64_t counts[kBucketCount] = {};
+	uint64_t count = 0;
+	double sum = 0;
+
+	template <typename Phase>
+	void Add(Phase const& phase) {
+		for (size_t i = 0; i < kBucketCount; ++i) {
+			counts[i] += phase.counts[i].load(std::memory_order_relaxed);
+		}
+		count += phase.count.load(std::memory_order_relaxed);
+		sum += phase.sum.load(std::memory_order_relaxed);
+	}
+};
+
+struct Registry {
+	std::mutex mutex;
+	std::vector<void*> threads; // LocalCounters of the live threads
+	uint64_t exited[kSectorCounterCount] = {}; // of the threads gone
+	std::map<std::string, Histogram> phases; // of the threads gone
+};
+
+// MSVC names a member function with its class, gcc without
+std::string PhaseName(std::string const& phase) {
+	auto colon = phase.rfind("::");
+	return colon == std::string::npos ? phase : phase.substr(colon + 2);
+}
+
+// never destroyed, threads may still exit after the statics are gone
+Registry& GetRegistry() {
+	static Registry* registry = new Registry;
+	return *registry;
+}
+
+struct Snapshot {
+	uint64_t counters[kSectorCounterCount] = {};
+	uint64_t minor_faults = 0;
+	uint64_t major_faults = 0;
+	std::map<std::string, Histogram> phases;
+
+	double items_per_second() const {
+		auto it = phases.find("InitData");
+		if (it == phases.end() || it->second.sum <= 0)
+			return 0;
+		return counters[kSectorItemsCreated] / it->second.sum;
+	}
+};
+
+} // namespace
+
+// the registry's view of the threads, see SectorMetrics::LocalCounters
+struct SectorMetricsAccess {
+	template <typename Fn>
+	static void ForEachThread(Registry& registry, Fn const& fn) {
+		for (auto thread : registry.threads) {
+			auto& local = *(SectorMetrics::LocalCounters*)thread;
+			std::lock_guard<std::mutex> lock(local.mutex);
+			fn(local);
+		}
+	}
+};
+
+namespace {
+
+Snapshot TakeSnapshot() {
+	Snapshot snapshot;
+	auto& registry = GetRegistry();
+	{
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (size_t i = 0; i < kSectorCounterCount; ++i) {
+			snapshot.counters[i] = registry.exited[i];
+		}
+		snapshot.phases = registry.phases;
+		SectorMetricsAccess::ForEachThread(registry, [&](auto& local) {
+			for (size_t i = 0; i < kSectorCounterCount; ++i) {
+				snapshot.counters[i] +=
+					local.values[i].load(std::memory_order_relaxed);
+			}
+			for (auto const& phase : local.phases) {
+				snapshot.phases[phase.first].Add(phase.second);
+			}
+		});
+	}
+	// a phase reset to zero is left out, as if it had never run
+	for (auto it = snapshot.phases.begin(); it != snapshot.phases.end();) {
+		if (it->second.count == 0)
+			it = snapshot.phases.erase(it);
+		else
+			++it;
+	}
+
+#if defined(_WIN32)
+	// soft and hard faults together
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		snapshot.minor_faults = counters.PageFaultCount;
+#elif defined(__linux__)
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		snapshot.minor_faults = (uint64_t)usage.ru_minflt;
+		snapshot.major_faults = (uint64_t)usage.ru_majflt;
+	}
+#endif
+	return snapshot;
+}
+
+// for JSON strings and Prometheus label values alike
+std::string Escape(std::string const& s) {
+	std::string ret;
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if (c == '\n') {
+			ret += "\\n";
+		} else if ((unsigned char)c >= 0x20) {
+			ret += c;
+		}
+	}
+	return ret;
+}
+
+} // namespace
+
+SectorMetrics::LocalPhase::LocalPhase() noexcept {
+	for (auto& n : counts) {
+		n.store(0, std::memory_order_relaxed);
+	}
+	count.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+}
+
+void SectorMetrics::LocalPhase::Add(double seconds) noexcept {
+	size_t bucket = 0;
+	while (bucket < kBucketCount - 1 && seconds > kBounds[bucket]) ++bucket;
+	auto add = [](std::atomic<uint64_t>& value) {
+		value.store(value.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+	};
+	add(counts[bucket]);
+	add(count);
+	sum.store(sum.load(std::memory_order_relaxed) + seconds,
+		std::memory_order_relaxed);
+}
+
+SectorMetrics::LocalCounters::LocalCounters() noexcept {
+	for (auto& value : values) {
+		value.store(0, std::memory_order_relaxed);
+	}
+	auto& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	registry.threads.push_back(this);
+}
+
+SectorMetrics::LocalCounters::~LocalCounters() {
+	auto& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (size_t i = 0; i < kSectorCounterCount; ++i) {
+		registry.exited[i] += values[i].load(std::memory_order_relaxed);
+	}
+	for (auto const& phase : phases) {
+		registry.phases[phase.first].Add(phase.second);
+	}
+	registry.threads.erase(std::find(registry.threads.begin(),
+		registry.threads.end(), this));
+}
+
+SectorMetrics::LocalPhase& SectorMetrics::LocalCounters::Phase(
+	std::string const& name) noexcept {
+	// only this thread adds, so it may look up without the lock
+	auto it = phases.find(name);
+	if (it != phases.end())
+		return it->second;
+	std::lock_guard<std::mutex> lock(mutex);
+	return phases[name];
+}
+
+void SectorMetrics::Record(std::string const& phase, double seconds) noexcept {
+	Local().Phase(PhaseName(phase)).Add(seconds);
+}
+
+void SectorMetrics::Record(char const* phase, double seconds) noexcept {
+	auto& local = Local();
+	for (auto const& literal : local.literals) {
+		if (literal.first == phase) {
+			literal.second->Add(seconds);
+			return;
+		}
+	}
+	LocalPhase& local_phase = local.Phase(PhaseName(phase));
+	local.literals.emplace_back(phase, &local_phase);
+	local_phase.Add(seconds);
+}
+
+std::string SectorMetrics::ToJson() noexcept {
+	Snapshot snapshot = TakeSnapshot();
+	std::ostringstream out;
+	out << std::setprecision(9);
+	out << "{\n  \"counters\": {";
+	for (size_t i = 0; i < kSectorCounterCount; ++i) {
+		out << (i ? ", " : "") << "\"" << kCounterNames[i] << "\": " <<
+			snapshot.counters[i];
+	}
+	out << "},\n";
+	out << "  \"page_faults\": {\"minor\": " << snapshot.minor_faults <<
+		", \"major\": " << snapshot.major_faults << "},\n";
+	out << "  \"items_per_second\": " << snapshot.items_per_second() << ",\n";
+	out << "  \"phases\": {";
+	bool first = true;
+	for (auto const& phase : snapshot.phases) {
+		auto const& histogram = phase.second;
+		out << (first ? "\n" : ",\n") << "    \"" << Escape(phase.first) <<
+			"\": {\"count\": " << histogram.count << ", \"seconds\": " <<
+			histogram.sum << ", \"buckets\": [";
+		for (size_t i = 0; i < kBucketCount; ++i) {
+			out << (i ? ", " : "") << "{\"le\": ";
+			if (i < kBucketCount - 1)
+				out << kBounds[i];
+			else
+				out << "\"+Inf\"";
+			out << ", \"count\": " << histogram.counts[i] << "}";
+		}
+		out << "]}";
+		first = false;
+	}
+	out << (first ? "}\n" : "\n  }\n") << "}\n";
+	return out.str();
+}
+
+std::string SectorMetrics::ToPrometheus() noexcept {
+	Snapshot snapshot = TakeSnapshot();
+	std::ostringstream out;
+	out << std::setprecision(9);
+	for (size_t i = 0; i < kSectorCounterCount; ++i) {
+		out << "# TYPE pos_" << kCounterNames[i] << "_total counter\n";
+		out << "pos_" << kCounterNames[i] << "_total " <<
+			snapshot.counters[i] << "\n";
+	}
+	out << "# TYPE pos_page_faults_total counter\n";
+	out << "pos_page_faults_total{kind=\"minor\"} " << snapshot.minor_faults <<
+		"\n";
+	out << "pos_page_faults_total{kind=\"major\"} " << snapshot.major_faults <<
+		"\n";
+	out << "# TYPE pos_items_per_second gauge\n";
+	out << "pos_items_per_second " << snapshot.items_per_second() << "\n";
+
+	out << "# TYPE pos_phase_seconds histogram\n";
+	for (auto const& phase : snapshot.phases) {
+		auto const& histogram = phase.second;
+		std::string label = "phase=\"" + Escape(phase.first) + "\"";
+		uint64_t cumulative = 0;
+		for (size_t i = 0; i < kBucketCount; ++i) {
+			cumulative += histogram.counts[i];
+			out << "pos_phase_seconds_bucket{" << label << ",le=\"";
+			if (i < kBucketCount - 1)
+				out << kBounds[i];
+			else
+				out << "+Inf";
+			out << "\"} " << cumulative << "\n";
+		}
+		out << "pos_phase_seconds_sum{" << label << "} " << histogram.sum <<
+			"\n";
+		out << "pos_phase_seconds_count{" << label << "} " << histogram.count <<
+			"\n";
+	}
+	return out.str();
+}
+
+bool SectorMetrics::Export(std::string const& pathname) noexcept {
+	std::string const kJson = ".json";
+	bool json = pathname.size() >= kJson.size() &&
+		pathname.compare(pathname.size() - kJson.size(), kJson.size(),
+		kJson) == 0;
+	std::string text = json ? ToJson() : ToPrometheus();
+	return WriteFileDurable(pathname, text.data(), text.size());
+}
+
+// A thread adding at the same time may keep its old count. The phases of
+// the live threads are zeroed in place, their literals still point at them.
+void SectorMetrics::Reset() noexcept {
+	auto& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (size_t i = 0; i < kSectorCounterCount; ++i) {
+		registry.exited[i] = 0;
+	}
+	registry.phases.clear();
+	SectorMetricsAccess::ForEachThread(registry, [](auto& local) {
+		for (auto& value : local.values) {
+			value.store(0, std::memory_order_relaxed);
+		}
+		for (auto& phase : local.phases) {
+			for (auto& n : phase.second.counts) {
+				n.store(0, std::memory_order_relaxed);
+			}
+			phase.second.count.store(0, std::memory_order_relaxed);
+			phase.second.sum.store(0, std::memory_order_relaxed);
+		}
+	});
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "public.h"
+#include <atomic>
+#include <mutex>
+
+enum SectorCounter {
+	kSectorHashes, // sha256 compressions
+	kSectorItemsCreated, // by InitData, for items per second
+	kSectorBytesRead, // batched reads of the data
+	kSectorBytesWritten, // items stored by InitData and Persist
+	kSectorProofsGenerated,
+	kSectorProofsVerified,
+	kSectorCounterCount,
+};
+
+// Process wide counters and latency histograms of the phases. A counter is
+// a plain word of the thread that adds to it, summed over the threads on
+// export, so the hash loops pay no lock and no shared cache line. A phase
+// is recorded per call, by Tick, into a histogram by name that is kept the
+// same way: per thread, summed on export. Export writes JSON, or
+// Prometheus text for node_exporter's textfile collector.
+class SectorMetrics {
+public:
+	static void Add(SectorCounter counter, uint64_t n) noexcept {
+		auto& value = Local().values[counter];
+		value.store(value.load(std::memory_order_relaxed) + n,
+			std::memory_order_relaxed);
+	}
+
+	// seconds of one call of the phase
+	static void Record(std::string const& phase, double seconds) noexcept;
+
+	// as above without a lookup by name after the first call of a thread,
+	// phase must stay valid and unchanged, e.g. __FUNCTION__ or a literal
+	static void Record(char const* phase, double seconds) noexcept;
+
+	static std::string ToJson() noexcept;
+	static std::string ToPrometheus() noexcept;
+
+	// JSON when pathname ends with .json, else Prometheus text. The file is
+	// replaced at once, a reader never sees half of it.
+	static bool Export(std::string const& pathname) noexcept;
+
+	// counters and histograms back to zero, e.g. between benchmark runs
+	static void Reset() noexcept;
+
+	// histogram buckets of a phase, the last one is +Inf
+	static size_t const kBucketCount = 10;
+
+private:
+	friend struct SectorMetricsAccess; // sector_metrics.cpp
+
+	// one phase of one thread, written by it alone
+	struct LocalPhase {
+		std::atomic<uint64_t> counts[kBucketCount];
+		std::atomic<uint64_t> count;
+		std::atomic<double> sum;
+
+		LocalPhase() noexcept;
+		void Add(double seconds) noexcept;
+	};
+
+	// the counters and phases of one thread, folded into the totals when it
+	// exits
+	struct LocalCounters {
+		std::atomic<uint64_t> values[kSectorCounterCount];
+		// taken by the thread only to add a phase, the readers hold it to
+		// walk the map
+		std::mutex mutex;
+		std::map<std::string, LocalPhase> phases;
+		// Record(char const*) by address, the thread's alone
+		std::vector<std::pair<char const*, LocalPhase*>> literals;
+
+		LocalCounters() noexcept;
+		~LocalCounters();
+
+		LocalPhase& Phase(std::string const& name) noexcept;
+	};
+
+	static LocalCounters& Local() noexcept {
+		thread_local LocalCounters local;
+		return local;
+	}
+};
@@ -3,8 +3,12 @@
 #include "public.h"
 #include "bigint.h"
 #include "sha256_compress.h"
+#include "sector_metrics.h"
 #include <boost/iostreams/detail/ios.hpp> // streamsize.
 #include <boost/iostreams/categories.hpp>
+#if defined(_MSC_VER) && defined(SHA256_COMPRESS_X86)
+#include <xmmintrin.h>
+#endif
 
 struct SectorItem {
 	SectorItem() {}
@@ -77,6 +81,7 @@ struct SectorItem {
 		}
 		SectorItem ret;
 		Sha256Compress2(data, ret.data);
+		SectorMetrics::Add(kSectorHashes, 1);
 		return ret;
 	}
 
@@ -88,6 +93,27 @@ struct SectorItem {
 			data[i + 8] = b.data[i];
 		}
 		Sha256Compress2(data, ret->data);
+		SectorMetrics::Add(kSectorHashes, 1);
+	}
+
+	// ret[i] = CompressTwo(items[2i], items[2i+1]), ret may point at items
+	static void CompressTwoBatch(SectorItem const* items, uint64_t count,
+		SectorItem* ret) {
+		static_assert(sizeof(SectorItem) == sizeof(uint32_t) * 8, "layout");
+		Sha256Compress2Batch((uint32_t const*)items, (uint32_t*)ret,
+			(size_t)count);
+		SectorMetrics::Add(kSectorHashes, count);
+	}
+
+	// hint the cache about an upcoming random read
+	static void Prefetch(SectorItem const* item) {
+#if defined(_MSC_VER) && defined(SHA256_COMPRESS_X86)
+		_mm_prefetch((char const*)item, _MM_HINT_T0);
+#elif defined(__GNUC__)
+		__builtin_prefetch(item);
+#else
+		(void)item;
+#endif
 	}
 
 	static SectorItem Xor(SectorItem const& a, SectorItem const& b) {
@@ -105,6 +131,17 @@ struct SectorItem {
 	}
 };
 
+// a proof whose items live elsewhere, see SectorProofView
+struct SectorProofRef {
+	SectorItem const* node_c;
+	SectorItem const* node_cx;
+	SectorItem const* node_cy;
+	SectorItem const* node_cyx;
+	SectorItem const* node_cyy;
+	SectorItem const* mkl_path_c;
+	size_t mkl_path_len;
+};
+
 struct SectorProof {
 	SectorItem node_c;
 	SectorItem node_cx;
@@ -134,6 +171,10 @@ struct SectorProof {
 		size_t sector_size = sizeof(uint32_t) * 8;
 		return (mkl_path_c.size() + 5)*sector_size;
 	}
+	SectorProofRef ref() const {
+		return SectorProofRef{ &node_c, &node_cx, &node_cy, &node_cyx,
+			&node_cyy, mkl_path_c.data(), mkl_path_c.size() };
+	}
 };
 
 static uint64_t const kSectorSizeK = (uint64_t)1 << 10;
@@ -144,10 +185,133 @@ static uint64_t const kSectorSizeT = (uint64_t)1 << 40;
 typedef std::function<
 	void(int percent, std::string desc)> SectorProgressCallback;
 
+struct SectorOptions {
+	// threads for the block passes, 0 means one per core
+	uint32_t thread_count = 0;
+
+	// Keep every k-th tree level inside the blocks in a .tre file, so a
+	// proof reads 2^k nodes per k levels instead of rehashing its block.
+	// 1 keeps the full tree (about data_size extra), 4 about data_size / 15.
+	// 0 keeps no level.
+	uint32_t tree_level_step = 0;
+
+	// Stripe the data over these directories instead of one .dat in the data
+	// path, <sector_id>.<i>.dat in the i-th, stripe_size bytes (2^x, at least
+	// 32 KB) at a time. Put each on its own disk.
+	std::vector<std::string> stripe_paths;
+	uint64_t stripe_size = 1024 * 1024;
+
+	// Make the created part durable this often, see SectorProver::Resume.
+	// 0 writes no checkpoint.
+	uint32_t checkpoint_seconds = 300;
+
+	// Bytes of RAM for InitData's items, for sectors far larger than RAM: a
+	// write behind tail and a cache of older items instead of mapping the
+	// data (Linux). 0 maps the data files. Needs at least 4 MB.
+	uint64_t ram_budget = 0;
+
+	// Keep the items in RAM only, in 1 GB or 2 MB huge pages where reserved,
+	// else transparent ones: no data file is written, SectorProver::Persist
+	// writes it afterwards. Open loads a persisted sector into RAM. The meta
+	// and tree files stay on the meta and tree paths.
+	bool in_memory = false;
+	// NUMA node for the in_memory pages, -1 for the default policy
+	int numa_node = -1;
+};
+
+// how an InitData under a RAM budget spent its time
+struct SectorCacheStats {
+	uint64_t hits = 0; // older items found in the cache
+	uint64_t misses = 0; // older items read from disk
+	uint64_t bytes_read = 0;
+	uint64_t bytes_written = 0;
+	double read_stall_seconds = 0; // waiting for misses
+	double write_stall_seconds = 0; // waiting for the write behind
+};
+
+// Packed proofs start with this header, the legacy format is a bare gzip
+// stream (1f 8b). Items are host order words, as in memory.
+// Version 1 is a merkle multiproof, after the header:
+//   for each distinct challenge in ascending order:
+//     node_cx (even challenges only), node_cyx, node_cyy
+//   for each level from the leafs up, in ascending position:
+//     the siblings that are not known nodes of the level
+// node_c and node_cy are rebuilt by the verifier, node_cx of an odd
+// challenge is its level 0 sibling.
+// Version 2 is flat, count proofs of node_c, node_cx, node_cy, node_cyx,
+// node_cyy and the mkl_path_c items, read in place by SectorProofView.
+static uint32_t const kSectorProofMagic = 0x50536f50; // "PoSP"
+static uint16_t const kSectorProofMultiproof = 1;
+static uint16_t const kSectorProofFlat = 2;
+
 #pragma pack(push)
 #pragma pack(4)
 struct SectorProofHeader {
-	uint16_t index_len;
+	uint32_t magic;
+	uint16_t version;
 	uint16_t reserved;
+	uint32_t count; // challenges
 };
 #pragma pack(pop)
+
+// Version 2 proofs read in place, the buffer must outlive the view and be
+// aligned to 4 bytes.
+class SectorProofView {
+public:
+	SectorProofView()
+		: items_(nullptr)
+		, count_(0)
+		, mkl_path_len_(0) {
+	}
+
+	// false unless data holds a whole version 2 proof
+	bool Reset(char const* data, size_t size, size_t mkl_path_len) {
+		items_ = nullptr;
+		count_ = 0;
+		mkl_path_len_ = mkl_path_len;
+
+		SectorProofHeader header;
+		if (size < sizeof(header) || ((uintptr_t)data % 4) != 0)
+			return false;
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != kSectorProofMagic ||
+			header.version != kSectorProofFlat)
+			return false;
+		size_t proof_size = sizeof(SectorItem) * (5 + mkl_path_len);
+		if ((size - sizeof(header)) / proof_size != header.count ||
+			(size - sizeof(header)) % proof_size != 0)
+			return false;
+
+		items_ = (SectorItem const*)(data + sizeof(header));
+		count_ = header.count;
+		return true;
+	}
+
+	size_t size() const {
+		return count_;
+	}
+
+	SectorProofRef operator[](size_t i) const {
+		SectorItem const* p = items_ + i * (5 + mkl_path_len_);
+		return SectorProofRef{ p, p + 1, p + 2, p + 3, p + 4, p + 5,
+			mkl_path_len_ };
+	}
+
+	SectorProof to_proof(size_t i) const {
+		auto ref = (*this)[i];
+		SectorProof proof;
+		proof.node_c = *ref.node_c;
+		proof.node_cx = *ref.node_cx;
+		proof.node_cy = *ref.node_cy;
+		proof.node_cyx = *ref.node_cyx;
+		proof.node_cyy = *ref.node_cyy;
+		proof.mkl_path_c.assign(ref.mkl_path_c,
+			ref.mkl_path_c + ref.mkl_path_len);
+		return proof;
+	}
+
+private:
+	SectorItem const* items_;
+	size_t count_;
+	size_t mkl_path_len_;
+};
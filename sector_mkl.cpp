@@ -0,0 +1,271 @@
+#include "sector_mkl.h"
+#include "tick.h"
+
+SectorMklStack::SectorMklStack() {
+	s_.reserve(64);
+	level_index_.fill(0);
+}
+
+void SectorMklStack::SetLevelSink(uint64_t mask, LevelSink sink,
+	uint64_t first_leaf) noexcept {
+	level_mask_ = mask;
+	level_sink_ = std::move(sink);
+	for (int height = 0; height < 64; ++height) {
+		level_index_[height] = first_leaf >> height;
+	}
+}
+
+void SectorMklStack::Emit(int height, SectorItem const* nodes,
+	uint64_t count) noexcept {
+	if (!(level_mask_ & ((uint64_t)1 << height)))
+		return;
+	level_sink_(height, level_index_[height], nodes, count);
+	level_index_[height] += count;
+}
+
+void SectorMklStack::PushLeafs(SectorItem const* begin,
+	uint64_t count) noexcept {
+	assert((count & (count - 1)) == 0);
+	uint64_t const chunk_size = std::min(count, kChunkSize);
+	int chunk_height = 0;
+	while (((uint64_t)1 << chunk_height) < chunk_size) ++chunk_height;
+
+	if (chunk_size == 1) {
+		for (uint64_t offset = 0; offset < count; ++offset) {
+			Emit(0, begin + offset, 1);
+			Push(begin[offset], 0);
+		}
+		return;
+	}
+
+	chunk_.resize(std::max<size_t>(chunk_.size(), chunk_size / 2));
+	for (uint64_t offset = 0; offset < count; offset += chunk_size) {
+		Emit(0, begin + offset, chunk_size);
+		SectorItem::CompressTwoBatch(begin + offset, chunk_size / 2,
+			chunk_.data());
+		Emit(1, chunk_.data(), chunk_size / 2);
+		for (uint64_t n = chunk_size / 4, height = 2; n > 0; n /= 2, ++height) {
+			SectorItem::CompressTwoBatch(chunk_.data(), n, chunk_.data());
+			Emit((int)height, chunk_.data(), n);
+		}
+		Push(chunk_[0], chunk_height);
+	}
+}
+
+void SectorMklStack::Push(SectorItem const& item, int height) noexcept {
+	s_.emplace_back(item, height);
+
+	while (s_.size() >= 2) {
+		auto& right = s_[s_.size() - 1];
+		auto& left = s_[s_.size() - 2];
+		if (right.second != left.second)
+			break;
+		SectorItem::CompressTwo(left.first, right.first, &left.first);
+		++left.second;
+		Emit(left.second, &left.first, 1);
+		s_.pop_back();
+	}
+}
+
+SectorItem const& SectorMklStack::root(uint64_t count) const noexcept {
+	if (s_.size() != 1) {
+		SUICIDE(std::to_string(s_.size()) + " != 1");
+	}
+
+	if (((uint64_t)1 << s_[0].second) != count) {
+		SUICIDE(std::to_string(s_[0].second) + " !=" +
+			std::to_string(count));
+	}
+
+	return s_[0].first;
+}
+
+void SectorMklStack::Clear() noexcept {
+	s_.clear();
+}
+
+void CaculateMklRoot(SectorItem const* begin, uint64_t count,
+	SectorItem* root) noexcept {
+	SectorMklStack s;
+	s.PushLeafs(begin, count);
+	*root = s.root(count);
+}
+
+void GetMklPath(SectorItem const* begin, uint64_t count, uint64_t pos,
+	std::vector<SectorItem>& path) noexcept {
+	std::vector<SectorItem> level;
+	GetMklPath(begin, count, pos, path, level);
+}
+
+void GetMklPath(SectorItem const* begin, uint64_t count, uint64_t pos,
+	std::vector<SectorItem>& path, std::vector<SectorItem>& level) noexcept {
+	assert((count & (count - 1)) == 0);
+	assert(pos < count);
+	if (count < 2)
+		return;
+
+	path.push_back(begin[pos ^ 1]);
+	if (count == 2)
+		return;
+
+	level.resize(count / 2);
+	SectorItem::CompressTwoBatch(begin, count / 2, level.data());
+	for (uint64_t n = count / 2; n > 1; n /= 2) {
+		pos /= 2;
+		path.push_back(level[pos ^ 1]);
+		if (n > 2) {
+			SectorItem::CompressTwoBatch(level.data(), n / 2, level.data());
+		}
+	}
+}
+
+void GetMklPaths(SectorItem const* begin, uint64_t count,
+	std::vector<uint64_t> const& leafs,
+	std::vector<std::vector<SectorItem>>& paths, SectorItem* root) noexcept {
+	assert((count & (count - 1)) == 0);
+	int top = 0;
+	while (((uint64_t)1 << top) < count) ++top;
+	paths.resize(leafs.size());
+
+	std::vector<uint32_t> order(leafs.size());
+	for (size_t i = 0; i < leafs.size(); ++i) {
+		assert(leafs[i] < count);
+		order[i] = (uint32_t)i;
+		paths[i].reserve(paths[i].size() + top);
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return leafs[a] < leafs[b];
+	});
+
+	// per level: the next sorted leaf, the last node of the previous run
+	std::array<size_t, 64> cursors;
+	std::array<SectorItem, 64> lasts;
+	cursors.fill(0);
+
+	SectorMklStack mkl_stack;
+	uint64_t mask = ((uint64_t)1 << top) - 1;
+	mkl_stack.SetLevelSink(mask, [&](int height, uint64_t index,
+		SectorItem const* nodes, uint64_t n) {
+		// a leaf takes its sibling once both nodes of the pair are built
+		auto& cursor = cursors[height];
+		for (; cursor < order.size(); ++cursor) {
+			auto i = order[cursor];
+			uint64_t pos = leafs[i] >> height;
+			if ((pos | 1) >= index + n)
+				break;
+			uint64_t sibling = pos ^ 1;
+			if (sibling >= index) {
+				paths[i].push_back(nodes[sibling - index]);
+			} else {
+				assert(sibling + 1 == index);
+				paths[i].push_back(lasts[height]);
+			}
+		}
+		lasts[height] = nodes[n - 1];
+	});
+	mkl_stack.PushLeafs(begin, count);
+	*root = mkl_stack.root(count);
+}
+
+// the former per node std::vector<bool> flags, kept as the reference
+void LegacyGetMklPaths(SectorItem const* begin, uint64_t count,
+	std::vector<uint64_t> const& leafs,
+	std::vector<std::vector<SectorItem>>& paths, SectorItem* root) {
+	paths.resize(leafs.size());
+
+	struct H {
+		SectorItem item;
+		int height;
+		std::vector<bool> flags;
+	};
+	std::vector<H> s;
+	uint64_t offset = 0;
+	for (;;) {
+		if (s.size() >= 2) {
+			auto& right = s[s.size() - 1];
+			auto& left = s[s.size() - 2];
+			if (right.height == left.height) {
+				std::vector<bool> flags(leafs.size());
+				for (size_t i = 0; i < flags.size(); ++i) {
+					if (right.flags[i]) {
+						paths[i].push_back(left.item);
+						flags[i] = true;
+					} else if (left.flags[i]) {
+						paths[i].push_back(right.item);
+						flags[i] = true;
+					}
+				}
+				SectorItem::CompressTwo(left.item, right.item, &left.item);
+				left.height += 1;
+				left.flags = std::move(flags);
+				s.pop_back();
+				continue;
+			}
+		}
+		if (offset == count)
+			break;
+
+		s.resize(s.size() + 1);
+		auto& last_s = s[s.size() - 1];
+		last_s.flags.resize(leafs.size());
+		for (size_t i = 0; i < leafs.size(); ++i) {
+			last_s.flags[i] = (offset == leafs[i]);
+		}
+		last_s.item = begin[offset++];
+		last_s.height = 0;
+	}
+	*root = s[0].item;
+}
+
+void test_mkl_paths() {
+	std::mt19937_64 rng(1);
+	std::vector<SectorItem> items(1 << 16);
+	for (auto& item : items) {
+		for (auto& i : item.data) i = (uint32_t)rng();
+	}
+
+	for (uint64_t count : { 1, 2, 4, 64, 1 << 12 }) {
+		for (size_t leaf_count : { 0, 1, 3, 100 }) {
+			std::vector<uint64_t> leafs;
+			for (size_t i = 0; i < leaf_count; ++i) {
+				leafs.push_back(rng() % count);
+			}
+			if (leaf_count > 1)
+				leafs.push_back(leafs[0]); // duplicate
+
+			std::vector<std::vector<SectorItem>> expect, paths;
+			SectorItem expect_root, root;
+			LegacyGetMklPaths(items.data(), count, leafs, expect, &expect_root);
+			GetMklPaths(items.data(), count, leafs, paths, &root);
+			assert(root == expect_root);
+			assert(paths == expect);
+			std::vector<SectorItem> level; // reused, as by the prover
+			for (size_t i = 0; i < leafs.size(); ++i) {
+				std::vector<SectorItem> path, path2;
+				GetMklPath(items.data(), count, leafs[i], path);
+				GetMklPath(items.data(), count, leafs[i], path2, level);
+				assert(path == expect[i] && path2 == expect[i]);
+			}
+		}
+	}
+
+	// a block of 2^16 leafs, challenged as a whole batch
+	for (size_t leaf_count : { 16, 256, 2048 }) {
+		std::vector<uint64_t> leafs;
+		for (size_t i = 0; i < leaf_count; ++i) {
+			leafs.push_back(rng() % items.size());
+		}
+		std::vector<std::vector<SectorItem>> expect, paths;
+		SectorItem expect_root, root;
+		{
+			Tick tick("legacy " + std::to_string(leaf_count) + " leafs");
+			LegacyGetMklPaths(items.data(), items.size(), leafs, expect,
+				&expect_root);
+		}
+		{
+			Tick tick("sweep " + std::to_string(leaf_count) + " leafs");
+			GetMklPaths(items.data(), items.size(), leafs, paths, &root);
+		}
+		assert(root == expect_root && paths == expect);
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "public.h"
+#include "sector_misc.h"
+
+// Merkle root over leafs pushed in order, memory usage: O(lgN). Leafs are
+// hashed in subtrees of up to kChunkSize through the multi-lane compression,
+// the subtree roots are merged on the stack.
+class SectorMklStack {
+public:
+	static uint64_t const kChunkSize = 1024;
+
+	// nodes [index, index + count) of a level, in leaf order
+	typedef std::function<void(int height, uint64_t index,
+		SectorItem const* nodes, uint64_t count)> LevelSink;
+
+	SectorMklStack();
+
+	// Report the nodes of every height set in mask as they are built.
+	// first_leaf is the position of the next pushed leaf in the whole tree.
+	void SetLevelSink(uint64_t mask, LevelSink sink,
+		uint64_t first_leaf = 0) noexcept;
+
+	// push count (2^x) consecutive leafs
+	void PushLeafs(SectorItem const* begin, uint64_t count) noexcept;
+
+	// push the root of a subtree with 2^height leafs
+	void Push(SectorItem const& item, int height) noexcept;
+
+	// the root after exactly count leafs were pushed
+	SectorItem const& root(uint64_t count) const noexcept;
+
+	// drop the pending nodes, the level positions carry on
+	void Clear() noexcept;
+
+private:
+	void Emit(int height, SectorItem const* nodes, uint64_t count) noexcept;
+
+private:
+	typedef std::pair<SectorItem, int> H; // pair<item, height>
+	std::vector<H> s_;
+	std::vector<SectorItem> chunk_;
+	uint64_t level_mask_ = 0;
+	LevelSink level_sink_;
+	std::array<uint64_t, 64> level_index_;
+};
+
+// memory usage: O(lgN)
+void CaculateMklRoot(SectorItem const* begin, uint64_t count,
+	SectorItem* root) noexcept;
+
+// Append the siblings of leaf pos, from the bottom up to but not including
+// the root of the count (2^x) nodes. Costs count - 2 hashes.
+void GetMklPath(SectorItem const* begin, uint64_t count, uint64_t pos,
+	std::vector<SectorItem>& path) noexcept;
+
+// as above, the inner levels are built in level, the scratch of a caller
+// making many paths
+void GetMklPath(SectorItem const* begin, uint64_t count, uint64_t pos,
+	std::vector<SectorItem>& path, std::vector<SectorItem>& level) noexcept;
+
+// Append the siblings of every leafs[i] to paths[i], like GetMklPath, and
+// store the root of the count (2^x) nodes. The leafs are sorted once, each
+// level is then swept with its own cursor while the tree is built, so the
+// call costs count - 1 hashes plus the path lengths.
+void GetMklPaths(SectorItem const* begin, uint64_t count,
+	std::vector<uint64_t> const& leafs,
+	std::vector<std::vector<SectorItem>>& paths, SectorItem* root) noexcept;
+
+// GetMklPaths as it was, a vector of flags per node and leaf, the reference
+// of the tests and the bench
+void LegacyGetMklPaths(SectorItem const* begin, uint64_t count,
+	std::vector<uint64_t> const& leafs,
+	std::vector<std::vector<SectorItem>>& paths, SectorItem* root);
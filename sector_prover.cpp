@@ -1,10 +1,20 @@
 #include "sector_prover.h"
 #include "sector_verifier.h"
+#include "sector_mkl.h"
+#include "sector_cache.h"
+#include "thread_pool.h"
 #include "tick.h"
 #include "bigint.h"
 
 SectorProver::SectorProver(std::string user_id, std::string sector_id,
-	uint64_t data_size, std::string path)
+	uint64_t data_size, std::string path, SectorOptions const& options)
+	: SectorProver(std::move(user_id), std::move(sector_id), data_size,
+		path, path, path, options) {
+}
+
+SectorProver::SectorProver(std::string user_id, std::string sector_id,
+	uint64_t data_size, std::string data_path, std::string meta_path,
+	std::string tree_path, SectorOptions const& options)
 	: user_id_(std::move(user_id))
 	, sector_id_(std::move(sector_id))
 	, data_size_(data_size)
@@ -12,10 +22,14 @@ SectorProver::SectorProver(std::string user_id, std::string sector_id,
 	, block_size_(1ULL << ((uint64_t)(std::log2(data_count_)/2)))
 	, meta_size_(data_size / block_size_ + SHA256_DIGESTSIZE)
 	, meta_count_(meta_size_ / SHA256_DIGESTSIZE)
-	, path_(std::move(path))
-	, data_pathname_(path_ + "/" + sector_id_ + ".dat")
-	, meta_pathname_(path_ + "/" + sector_id_ + ".mta")
-	, prefix_(SectorItem(user_id_ + sector_id_)) {
+	, data_path_(std::move(data_path))
+	, meta_path_(std::move(meta_path))
+	, tree_path_(tree_path.empty() ? meta_path_ : std::move(tree_path))
+	, meta_pathname_(meta_path_ + "/" + sector_id_ + ".mta")
+	, tree_pathname_(tree_path_ + "/" + sector_id_ + ".tre")
+	, checkpoint_pathname_(meta_path_ + "/" + sector_id_ + ".ckp")
+	, prefix_(SectorItem(user_id_ + sector_id_))
+	, options_(options) {
 
 	if ((data_size & (data_size - 1)) != 0) { // must be 2^x
 		throw std::runtime_error("invalid data_size");
@@ -25,17 +39,50 @@ SectorProver::SectorProver(std::string user_id, std::string sector_id,
 		throw std::runtime_error("data_size too small");
 	}
 
-	if (path_.empty()) {
-		throw std::runtime_error("invalid pathname");
+	std::vector<std::string> paths{ data_path_, meta_path_, tree_path_ };
+	paths.insert(paths.end(), options_.stripe_paths.begin(),
+		options_.stripe_paths.end());
+	for (auto const& path : paths) {
+		if (path.empty()) {
+			throw std::runtime_error("invalid pathname");
+		}
+
+		std::error_code error_code;
+		if (!fs::exists(path, error_code) || error_code) {
+			throw std::runtime_error("path not exist");
+		}
+
+		if (!fs::is_directory(path, error_code) || error_code) {
+			throw std::runtime_error("path not directory");
+		}
 	}
 
-	std::error_code error_code;
-	if (!fs::exists(path_, error_code) || error_code) {
-		throw std::runtime_error("path not exist");
+	if (options_.stripe_paths.empty()) {
+		data_pathnames_.push_back(data_path_ + "/" + sector_id_ + ".dat");
+	} else {
+		// a chunk of leafs must not cross a stripe, see InitData
+		uint64_t stripe_size = options_.stripe_size;
+		if ((stripe_size & (stripe_size - 1)) != 0 ||
+			stripe_size < SectorMklStack::kChunkSize * sizeof(SectorItem) ||
+			data_size_ / stripe_size < options_.stripe_paths.size()) {
+			throw std::runtime_error("invalid stripe_size");
+		}
+		for (size_t i = 0; i < options_.stripe_paths.size(); ++i) {
+			data_pathnames_.push_back(options_.stripe_paths[i] + "/" +
+				sector_id_ + "." + std::to_string(i) + ".dat");
+		}
 	}
 
-	if (!fs::is_directory(path_, error_code) || error_code) {
-		throw std::runtime_error("path not directory");
+	block_height_ = 0;
+	while (((uint64_t)1 << block_height_) < block_size_) ++block_height_;
+
+	// the stored levels, each laid out over the whole sector
+	tree_size_ = 0;
+	for (int height = options_.tree_level_step;
+		options_.tree_level_step && height < block_height_;
+		height += options_.tree_level_step) {
+		tree_levels_.emplace_back(height, tree_size_ / SHA256_DIGESTSIZE);
+		tree_size_ += data_size_ >> height;
 	}
 	
 	InitD0();
@@ -47,47 +94,219 @@ bool SectorProver::Create(SectorProgressCallback const& progress) noexcept {
 
 	std::error_code error_code;
 
-	fs::space_info space = fs::space(path_, error_code);
-	if (error_code)
-		return false;
+	std::map<std::string, uint64_t> want_spaces;
+	AddWantSpaces(want_spaces);
+	for (auto const& want_space : want_spaces) {
+		fs::space_info space = fs::space(want_space.first, error_code);
+		if (error_code)
+			return false;
+		if (space.available < want_space.second)
+			return false;
+	}
 
-	uint64_t const kUselessSize = 1024 * 1024;
-	uint64_t want_space = data_size_ + meta_size_ + kUselessSize;
-	if (space.available < want_space)
-		return false;
+	// a checkpoint left from an older Create is not of these files
+	fs::remove(checkpoint_pathname_, error_code);
 
 	try {
 		InitData(progress);
 		OpenData();
 		InitMeta(progress);
 		OpenMeta();
+		OpenTree();
+		if (!BuildMetaTree())
+			throw std::runtime_error("meta root");
+		fs::remove(checkpoint_pathname_, error_code);
 		return true;
 	} catch (std::exception&) {
-		fs::remove(data_pathname_, error_code);
-		fs::remove(meta_pathname_, error_code);
+		Remove();
+		return false;
+	}
+}
+
+bool SectorProver::Resume(SectorProgressCallback const& progress) noexcept {
+	if (data_view_ || meta_view_ || options_.in_memory)
+		return false;
+
+	uint64_t block_count;
+	SectorItem last_root;
+	if (!ReadCheckpoint(&block_count, &last_root))
+		return false;
+
+	try {
+		// the tail before the checkpoint must be what the chain makes
+		OpenData();
+		OpenMeta();
+		OpenTree();
+		SectorItem const* meta_items = (SectorItem const*)meta_view_->data();
+		bool tail_ok = meta_items[block_count - 1] == last_root &&
+			CheckBlock(block_count - 1) &&
+			CheckChain((block_count - 1) * block_size_,
+				block_count * block_size_);
+		data_view_.reset();
+		meta_view_.reset();
+		tree_view_.reset();
+		if (!tail_ok)
+			return false;
+
+		InitData(progress, block_count);
+		OpenData();
+		InitMeta(progress);
+		OpenMeta();
+		OpenTree();
+		if (!BuildMetaTree())
+			throw std::runtime_error("meta root");
+	} catch (std::exception&) {
+		data_view_.reset();
+		meta_view_.reset();
+		tree_view_.reset();
+		meta_tree_.clear();
+		return false;
+	}
+
+	std::error_code error_code;
+	fs::remove(checkpoint_pathname_, error_code);
+	return true;
+}
+
+bool SectorProver::Repair(SectorRepairReport* report,
+	SectorProgressCallback const& progress) noexcept {
+	Tick tick(__FUNCTION__);
+	if (data_view_ || meta_view_ || options_.in_memory)
+		return false;
+
+	SectorRepairReport temp_report;
+	if (!report)
+		report = &temp_report;
+	*report = SectorRepairReport();
+	uint64_t const block_count = meta_count_ - 1;
+	report->block_count = block_count;
+
+	try {
+		OpenData();
+		OpenMeta();
+		OpenTree();
+		SectorItem const old_root = mkl_root();
+		report->meta_was_bad = !BuildMetaTree();
+
+		// Every item follows from the ones before it, so the first bad block
+		// is where the regeneration starts. Blocks past the first bad one
+		// found so far need no check.
+		std::atomic<uint64_t> first_bad(block_count);
+		ForEachBlock(0, block_count, [&](uint64_t i) {
+			if (i < first_bad && !CheckBlock(i)) {
+				uint64_t bad = first_bad;
+				while (i < bad && !first_bad.compare_exchange_weak(bad, i)) {
+				}
+			}
+			return true;
+		}, progress, "find bad block");
+		report->first_bad_block = first_bad;
+
+		data_view_.reset();
+		meta_view_.reset();
+		tree_view_.reset();
+		meta_tree_.clear();
+
+		if (report->first_bad_block < block_count || report->meta_was_bad) {
+			report->items_regenerated =
+				(block_count - report->first_bad_block) * block_size_;
+			report->blocks_rewritten = block_count - report->first_bad_block;
+			InitData(progress, report->first_bad_block,
+				&report->items_rewritten);
+			InitMeta(progress);
+		}
+
+		OpenData();
+		OpenMeta();
+		OpenTree();
+		if (!BuildMetaTree())
+			throw std::runtime_error("meta root");
+		report->root_changed = mkl_root() != old_root;
+	} catch (std::exception&) {
+		data_view_.reset();
+		meta_view_.reset();
+		tree_view_.reset();
+		meta_tree_.clear();
 		return false;
 	}
+
+	std::error_code error_code;
+	fs::remove(checkpoint_pathname_, error_code);
+	return !report->root_changed;
 }
 
-bool SectorProver::Open(SectorProver::OpenFlag flag) noexcept {
+// a creation that wrote a checkpoint keeps its files for Resume
+void SectorProver::Remove() noexcept {
+	data_view_.reset();
+	data_memory_.reset();
+	meta_view_.reset();
+	tree_view_.reset();
+	meta_tree_.clear();
+
+	std::error_code error_code;
+	if (fs::exists(checkpoint_pathname_, error_code))
+		return;
+	for (auto const& data_pathname : data_pathnames_) {
+		fs::remove(data_pathname, error_code);
+	}
+	fs::remove(meta_pathname_, error_code);
+	fs::remove(tree_pathname_, error_code);
+}
+
+bool SectorProver::Open(SectorProver::OpenFlag flag,
+	SectorProgressCallback const& progress) noexcept {
 	if (data_view_ || meta_view_)
 		return false;
 
 	try {
 		OpenData();
 		OpenMeta();
+		OpenTree();
 	} catch (std::exception&) {
 		return false;
 	}
 
+	// the files may come from different disks, make sure they belong together
+	if (!BuildMetaTree() || !CheckPair()) {
+		data_view_.reset();
+		meta_view_.reset();
+		tree_view_.reset();
+		meta_tree_.clear();
+		return false;
+	}
+
 	if (flag == OpenFlag::FastIntegrityCheck)
 		return FastCheckIntegrity();
 	if (flag == OpenFlag::FullIntegrityCheck)
-		return FullCheckIntegrity();
+		return FullCheckIntegrity(progress);
 
 	return true;
 }
 
+// the paths may share a disk
+void SectorProver::AddWantSpaces(
+	std::map<std::string, uint64_t>& want_spaces) const noexcept {
+	uint64_t const kUselessSize = 1024 * 1024;
+	if (!options_.in_memory) {
+		AddDataWantSpaces(want_spaces);
+	}
+	want_spaces[meta_path_] += meta_size_ + kUselessSize;
+	want_spaces[tree_path_] += tree_size_;
+}
+
+void SectorProver::AddDataWantSpaces(
+	std::map<std::string, uint64_t>& want_spaces) const noexcept {
+	uint64_t const kUselessSize = 1024 * 1024;
+	if (options_.stripe_paths.empty()) {
+		want_spaces[data_path_] += data_size_ + kUselessSize;
+	}
+	for (size_t i = 0; i < options_.stripe_paths.size(); ++i) {
+		want_spaces[options_.stripe_paths[i]] += kUselessSize +
+			SectorStripedView::FileSize(data_size_, options_.stripe_size,
+			options_.stripe_paths.size(), i);
+	}
+}
+
 SectorItem const& SectorProver::mkl_root() noexcept {
 	if (!data_view_ || !meta_view_) {
 		SUICIDE("not opened");
@@ -98,6 +317,10 @@ SectorItem const& SectorProver::mkl_root() noexcept {
 	return meta_root;
 }
 
+SectorCacheStats const& SectorProver::cache_stats() noexcept {
+	return cache_stats_;
+}
+
 SectorItem const& SectorProver::prefix() noexcept {
 	return prefix_;
 }
@@ -122,44 +345,216 @@ void SectorProver::CreateItem(uint64_t n, SectorItem const& dx,
 }
 
 // throw
-void SectorProver::InitData(SectorProgressCallback const& progress) {
+void SectorProver::InitData(SectorProgressCallback const& progress,
+	uint64_t first_block, uint64_t* rewritten) {
 	Tick tick(__FUNCTION__);
-	io::mapped_file_params params;
-	params.path = data_pathname_;
-	params.flags = io::mapped_file_base::readwrite;
-	params.new_file_size = data_size_;
-	io::mapped_file view(params);
-	SectorItem* items = (SectorItem*)view.data();
-	if (!items)
-		throw std::runtime_error("init data_view failed");
+	// a resumed creation or a repair writes into the files made before
+	bool const resume = first_block > 0 || rewritten;
+
+	io::mapped_file_params meta_params;
+	meta_params.path = meta_pathname_;
+	meta_params.flags = io::mapped_file_base::readwrite;
+	if (!resume)
+		meta_params.new_file_size = meta_size_;
+	io::mapped_file meta_view(meta_params);
+	SectorItem* meta_items = (SectorItem*)meta_view.data();
+	if (!meta_items || meta_view.size() != meta_size_)
+		throw std::runtime_error("init meta_view failed");
 
-	items[0] = d0_;
-	
-	for (uint64_t n = 1; n < data_count_; ++n) {
+	std::unique_ptr<io::mapped_file> tree_view;
+	SectorItem* tree_items = nullptr;
+	if (tree_size_) {
+		io::mapped_file_params tree_params;
+		tree_params.path = tree_pathname_;
+		tree_params.flags = io::mapped_file_base::readwrite;
+		if (!resume)
+			tree_params.new_file_size = tree_size_;
+		tree_view.reset(new io::mapped_file(tree_params));
+		tree_items = (SectorItem*)tree_view->data();
+		if (!tree_items || tree_view->size() != tree_size_)
+			throw std::runtime_error("init tree_view failed");
+	}
+
+	// a repair compares each item, it runs on the mapped files
+	if (options_.in_memory && !resume) {
+		data_memory_.reset(new SectorStripedView(data_pathnames_, data_size_,
+			options_.stripe_size, SectorStripedView::kMemory,
+			options_.numa_node));
+		RunChain(*data_memory_, meta_items, tree_items, 0, nullptr, progress);
+	} else if (options_.ram_budget && !rewritten &&
+		SectorItemCache::Supported(block_size_)) {
+		SectorItemCache items(data_pathnames_, data_size_,
+			options_.stripe_size, options_.ram_budget,
+			first_block * block_size_, !resume);
+		RunChain(items, meta_items, tree_items, first_block, nullptr, progress);
+		items.Flush();
+		cache_stats_ = items.stats();
+	} else {
+		SectorStripedView items(data_pathnames_, data_size_,
+			options_.stripe_size,
+			resume ? SectorStripedView::kWrite : SectorStripedView::kCreate);
+		RunChain(items, meta_items, tree_items, first_block, rewritten,
+			progress);
+	}
+}
+
+// items [first_block * block_size_, data_count_), Items is a
+// SectorStripedView or a SectorItemCache
+template <typename Items>
+void SectorProver::RunChain(Items& items, SectorItem* meta_items,
+	SectorItem* tree_items, uint64_t first_block, uint64_t* rewritten,
+	SectorProgressCallback const& progress) {
+	// block roots are built while the chain runs, from leafs that are still
+	// in cache, so InitMeta does not read the data again. A chunk is in one
+	// stripe.
+	uint64_t const chunk_size = std::min(block_size_,
+		SectorMklStack::kChunkSize);
+	SectorMklStack mkl_stack;
+	SetTreeSink(mkl_stack, tree_items, first_block * block_size_);
+
+	// checkpoints are taken at the end of a block, where the mkl stack is
+	// empty and the stored levels of the block are complete
+	auto const interval = std::chrono::seconds(options_.checkpoint_seconds);
+	auto last_checkpoint = std::chrono::steady_clock::now();
+	uint64_t synced_block = first_block;
+
+	auto push_leaf = [&](uint64_t n) {
+		if ((n + 1) % chunk_size == 0) {
+			mkl_stack.PushLeafs(&items[n + 1 - chunk_size], chunk_size);
+		}
+		if ((n + 1) % block_size_ == 0) {
+			meta_items[n / block_size_] = mkl_stack.root(block_size_);
+			mkl_stack.Clear();
+
+			uint64_t block_count = (n + 1) / block_size_;
+			auto now = std::chrono::steady_clock::now();
+			if (options_.checkpoint_seconds && !options_.in_memory &&
+				block_count < meta_count_ - 1 &&
+				now - last_checkpoint >= interval) {
+				// a failed one is retried with the next, over more blocks
+				if (items.Sync(synced_block * block_size_,
+					(block_count - synced_block) * block_size_) &&
+					WriteCheckpoint(meta_items, tree_items, synced_block,
+					block_count)) {
+					synced_block = block_count;
+				}
+				last_checkpoint = now;
+			}
+		}
+	};
+
+	// for SectorMetrics, at each progress report
+	uint64_t counted = first_block * block_size_;
+	auto count_items = [&](uint64_t n) {
+		SectorMetrics::Add(kSectorItemsCreated, n - counted);
+		SectorMetrics::Add(kSectorBytesWritten,
+			(n - counted) * sizeof(SectorItem));
+		counted = n;
+	};
+
+	uint64_t first = first_block * block_size_;
+	if (first == 0) {
+		if (rewritten && items[0] != d0_)
+			++*rewritten;
+		items[0] = d0_;
+		push_leaf(0);
+		first = 1;
+	}
+
+	for (uint64_t n = first; n < data_count_; ++n) {
 		SectorItem* dn = &items[n];
 		SectorItem* dn_1 = &items[n - 1];
 		uint64_t x = dn_1->get_parent_x(n);
 		uint64_t y = dn_1->get_parent_y(n);
-		SectorItem* dx = &items[x];
-		SectorItem* dy = &items[y];
-		CreateItem(n, *dx, *dy, dn);
+		// a cached item is valid until the next access, the one of dy may
+		// evict dx when n - 1 is not in the ring yet
+		SectorItem const dx = items[x];
+		SectorItem const* dy = &items[y];
+		if (rewritten) {
+			// a repair only dirties the pages of wrong items
+			SectorItem item;
+			CreateItem(n, dx, *dy, &item);
+			if (item != *dn) {
+				*dn = item;
+				++*rewritten;
+			}
+		} else {
+			CreateItem(n, dx, *dy, dn);
+		}
+		push_leaf(n);
 
 		if (n % 1000000 == 0) {
-			progress((int)(n * 100 / data_count_),
-				"init data: " + std::to_string(n));
+			count_items(n);
+			if (progress) {
+				progress((int)(n * 100 / data_count_),
+					"init data: " + std::to_string(n));
+			}
 		}
 	}
+	count_items(data_count_);
 }
 
 // throw
 void SectorProver::OpenData() {
-	io::mapped_file_params params;
-	params.path = data_pathname_;
-	data_view_.reset(new io::mapped_file_source(params));
-	if (data_view_->size() != data_size_)
-		throw std::runtime_error("data size");
-	if (!data_view_->data())
-		throw std::runtime_error("data open");
+	if (!options_.in_memory) {
+		data_view_.reset(new SectorStripedView(data_pathnames_, data_size_,
+			options_.stripe_size, SectorStripedView::kRead));
+		return;
+	}
+
+	if (!data_memory_) {
+		// a persisted sector, loaded into RAM
+		SectorStripedView files(data_pathnames_, data_size_,
+			options_.stripe_size, SectorStripedView::kRead);
+		data_memory_.reset(new SectorStripedView(data_pathnames_, data_size_,
+			options_.stripe_size, SectorStripedView::kMemory,
+			options_.numa_node));
+		for (uint64_t n = 0; n < data_count_; n += files.stripe_count()) {
+			memcpy(&(*data_memory_)[n], &files[n],
+				std::min(files.stripe_count(), data_count_ - n) *
+				sizeof(SectorItem));
+		}
+	}
+	data_view_ = std::move(data_memory_);
+}
+
+bool SectorProver::Persist(SectorProgressCallback const& progress) noexcept {
+	Tick tick(__FUNCTION__);
+	if (!options_.in_memory || !data_view_ || !meta_view_)
+		return false;
+
+	std::error_code error_code;
+	std::map<std::string, uint64_t> want_spaces;
+	AddDataWantSpaces(want_spaces);
+	for (auto const& want_space : want_spaces) {
+		fs::space_info space = fs::space(want_space.first, error_code);
+		if (error_code)
+			return false;
+		if (space.available < want_space.second)
+			return false;
+	}
+
+	try {
+		SectorStripedView files(data_pathnames_, data_size_,
+			options_.stripe_size, SectorStripedView::kCreate);
+		for (uint64_t n = 0; n < data_count_; n += files.stripe_count()) {
+			uint64_t count = std::min(files.stripe_count(), data_count_ - n);
+			memcpy(&files[n], &(*data_view_)[n], count * sizeof(SectorItem));
+			if (progress) {
+				progress((int)(n * 100 / data_count_),
+					"persist data: " + std::to_string(n));
+			}
+		}
+		if (!files.Sync(0, data_count_))
+			throw std::runtime_error("sync data");
+		SectorMetrics::Add(kSectorBytesWritten, data_size_);
+	} catch (std::exception&) {
+		for (auto const& data_pathname : data_pathnames_) {
+			fs::remove(data_pathname, error_code);
+		}
+		return false;
+	}
+	return true;
 }
 
 // throw
@@ -168,25 +563,14 @@ void SectorProver::InitMeta(SectorProgressCallback const& progress) {
 	io::mapped_file_params params;
 	params.path = meta_pathname_;
 	params.flags = io::mapped_file_base::readwrite;
-	params.new_file_size = meta_size_;
 	io::mapped_file view(params);
 	SectorItem* meta_items = (SectorItem*)view.data();
 	if (!meta_items)
 		throw std::runtime_error("init meta_view failed");
+	if (view.size() != meta_size_)
+		throw std::runtime_error("meta size");
 
-	SectorItem* data_items = (SectorItem*)data_view_->data();
-
-	// calculate all block root
-	for (uint64_t i = 0; i < data_count_ / block_size_; ++i) {
-		auto begin = data_items + i * block_size_;
-		CaculateMklRoot(begin, block_size_, &meta_items[i]);
-
-		if (i % 1000 == 0) {
-			progress((int)(i * 100 / (data_count_ / block_size_)),
-				"calculate block root: " + std::to_string(i));
-		}
-	}
-
+	// all block roots were written by InitData
 	assert(data_count_ / block_size_ == meta_count_ - 1);
 
 	// mkl tree root
@@ -195,7 +579,8 @@ void SectorProver::InitMeta(SectorProgressCallback const& progress) {
 	CaculateMklRoot(begin, count, &meta_items[meta_count_ - 1]);
 	
 	auto& meta_root = meta_items[meta_count_ - 1];
-	std::cout << "root: " << meta_root.to_string() << "\n";
+	if (Tick::console())
+		std::cout << "root: " << meta_root.to_string() << "\n";
 }
 
 // throw
@@ -209,182 +594,181 @@ void SectorProver::OpenMeta() {
 		throw std::runtime_error("meta open");
 }
 
-// memory usage: O(lgN)
-void SectorProver::CaculateMklRoot(SectorItem const* begin, uint64_t count,
-	SectorItem* root) noexcept {
-	assert((count & (count - 1)) == 0);
-	typedef std::pair<SectorItem, int> H; // pair<item, height>
-	std::vector<H> s;
-	s.reserve(256);
-
-	uint64_t offset = 0;
-	for (;;) {
-		if (s.size() >= 2) {
-			auto& right = s[s.size() - 1];
-			auto& left = s[s.size() - 2];
-			if (right.second == left.second) {
-				SectorItem::CompressTwo(left.first, right.first, &left.first);
-				++left.second;
-				s.pop_back();
-				continue;
-			}
-		}
-
-		if (offset == count) {
-			if (s.size() != 1) {
-				SUICIDE(std::to_string(s.size()) + " != 1");
-			}
-
-			if (((uint64_t)1 << s[0].second) != count) {
-				SUICIDE(std::to_string(s[0].second) + " !=" +
-					std::to_string(count));
-			}
+// each level of the tree is hashed in one batch, the levels stay
+// contiguous so a path walks up with two lookups per level
+// false if the stored root is not the root of the block roots
+bool SectorProver::BuildMetaTree() noexcept {
+	Tick tick(__FUNCTION__);
+	SectorItem const* meta_items = (SectorItem const*)meta_view_->data();
+	uint64_t count = meta_count_ - 1;
+	meta_tree_.resize(count * 2);
+	std::copy(meta_items, meta_items + count, &meta_tree_[count]);
+	for (uint64_t n = count / 2; n >= 1; n /= 2) {
+		SectorItem::CompressTwoBatch(&meta_tree_[n * 2], n, &meta_tree_[n]);
+	}
+	return meta_tree_[1] == meta_items[meta_count_ - 1];
+}
 
-			break;
-		}
+// throw
+void SectorProver::OpenTree() {
+	if (!tree_size_)
+		return;
+	io::mapped_file_params params;
+	params.path = tree_pathname_;
+	tree_view_.reset(new io::mapped_file_source(params));
+	if (tree_view_->size() != tree_size_)
+		throw std::runtime_error("tree size");
+	if (!tree_view_->data())
+		throw std::runtime_error("tree open");
+}
 
-		s.resize(s.size() + 1);
+uint64_t SectorProver::TreeLevelMask() const noexcept {
+	uint64_t mask = 0;
+	for (auto const& level : tree_levels_) {
+		mask |= (uint64_t)1 << level.first;
+	}
+	return mask;
+}
 
-		// push new leaf
-		s[s.size() - 1].first = begin[offset++];
-		s[s.size() - 1].second = 0;
+SectorItem const* SectorProver::TreeLevel(int height) const noexcept {
+	SectorItem const* tree_items = (SectorItem const*)tree_view_->data();
+	for (auto const& level : tree_levels_) {
+		if (level.first == height)
+			return tree_items + level.second;
 	}
+	SUICIDE("no tree level " + std::to_string(height));
+}
 
-	*root = s[0].first;
+void SectorProver::SetTreeSink(SectorMklStack& mkl_stack,
+	SectorItem* tree_items, uint64_t first_leaf) const noexcept {
+	if (!tree_items)
+		return;
+	std::vector<uint64_t> offsets(64);
+	for (auto const& level : tree_levels_) {
+		offsets[level.first] = level.second;
+	}
+	mkl_stack.SetLevelSink(TreeLevelMask(), [tree_items, offsets](int height,
+		uint64_t index, SectorItem const* nodes, uint64_t count) {
+		memcpy(tree_items + offsets[height] + index, nodes,
+			count * sizeof(SectorItem));
+	}, first_leaf);
 }
 
-void SectorProver::GetMklPaths(SectorItem const* begin, uint64_t count,
-	std::vector<uint64_t> leafs, SectorItem const* root,
+// leaf to block root, rebuild each challenged block
+void SectorProver::GetBlockMklPaths(std::vector<uint64_t> const& leafs,
 	std::vector<std::vector<SectorItem>>& paths) noexcept {
-	for (auto leaf : leafs) {
-		assert(leaf < count);
+	SectorItem* meta_items = (SectorItem*)meta_view_->data();
+	(void)meta_items; // for the assert of each block root
+	auto mkl_path_len = (size_t)std::log2(data_count_);
+	struct GroupLeaf {
+		std::vector<size_t> indexs;
+		std::vector<uint64_t> poss;
+		std::vector<std::vector<SectorItem>> proofs;
+	};
+	// ascending blocks, the disk head sweeps the file once
+	std::map<uint64_t, GroupLeaf> block_leafs;
+	for (size_t i = 0; i < leafs.size(); ++i) {
+		uint64_t block_index = leafs[i] / block_size_;
+		auto& group_leaf = block_leafs[block_index];
+		group_leaf.indexs.push_back(i);
+		group_leaf.poss.push_back(leafs[i] % block_size_);
 	}
-	paths.resize(leafs.size());
 
-	struct H {
-		uint64_t pos;
-		SectorItem item;
-		int height;
-		std::vector<bool> flags;
-	};
-	std::vector<H> s;
-	s.reserve(256);
-	uint64_t offset;
-
-	offset = 0;
-	for (;;) {
-		if (s.size() >= 2) {
-			auto& right = s[s.size() - 1];
-			auto& left = s[s.size() - 2];
-			if (right.height == left.height) {
-				std::vector<bool> flags;
-				flags.resize(leafs.size());
-				for (size_t i = 0; i < flags.size(); ++i) {
-					if (right.flags[i]) {
-						paths[i].push_back(left.item);
-						flags[i] = true;
-					} else if (left.flags[i]) {
-						paths[i].push_back(right.item);
-						flags[i] = true;
-					} else {
-						flags[i] = false;
-					}
-				}
-				SectorItem::CompressTwo(left.item, right.item, &left.item);
-				left.height += 1;
-				left.flags = std::move(flags);
-				s.pop_back();
-				continue;
-			}
-		}
+	// maybe some leafs exist in same block
+	std::vector<SectorItem> block(block_size_);
+	for (auto& block_leaf : block_leafs) {
+		uint64_t block_index = block_leaf.first;
+		auto& group_leaf = block_leaf.second;
 
-		if (offset == count) {
-			if (s.size() != 1) {
-				SUICIDE(std::to_string(s.size()) + " != 1");
-			}
-			break;
+		// one sequential read of the whole block
+		std::vector<SectorRead> reads{ SectorRead{
+			block_index * block_size_ * sizeof(SectorItem), block.data(),
+			(uint32_t)(block_size_ * sizeof(SectorItem)) } };
+		if (!data_view_->Read(reads)) {
+			SUICIDE("read block");
 		}
 
-		s.resize(s.size() + 1);
+		// sized for the meta levels too, they are appended later
+		group_leaf.proofs.resize(group_leaf.poss.size());
+		for (auto& proof : group_leaf.proofs) {
+			proof.reserve(mkl_path_len);
+		}
+		SectorItem block_root;
+		::GetMklPaths(block.data(), block_size_, group_leaf.poss,
+			group_leaf.proofs, &block_root);
+		assert(block_root == meta_items[block_index]);
 
-		// push new leaf
-		auto& last_s = s[s.size() - 1];
-		last_s.flags.resize(leafs.size());
-		last_s.pos = offset;
-		for (size_t i = 0; i < leafs.size(); ++i) {
-			auto leaf = leafs[i];
-			last_s.flags[i] = (offset == leaf);
+		for (size_t i = 0; i < group_leaf.indexs.size(); ++i) {
+			paths[group_leaf.indexs[i]] = std::move(group_leaf.proofs[i]);
 		}
-		last_s.item = begin[offset++];
-		last_s.height = 0;
 	}
+}
 
-	SectorItem const& cacu_root = s[0].item;
-	assert(cacu_root == *root);
+// leaf to block root from the stored levels, each band of tree_level_step
+// levels reads 2^step nodes of the band's bottom level. Bands are read level
+// by level in ascending position, so each level region is swept once.
+void SectorProver::GetTreeMklPaths(std::vector<uint64_t> const& leafs,
+	std::vector<std::vector<SectorItem>>& paths) noexcept {
+	std::vector<size_t> order(leafs.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&leafs](size_t a, size_t b) {
+		return leafs[a] < leafs[b];
+	});
+
+	std::vector<SectorItem> buf; // leafs across a stripe
+	std::vector<SectorItem> inner; // the levels GetMklPath builds
+	for (int height = 0; height < block_height_;) {
+		int top = std::min<int>(height + options_.tree_level_step,
+			block_height_);
+		uint64_t count = (uint64_t)1 << (top - height);
+		SectorItem const* level = height ? TreeLevel(height) : nullptr;
+		for (auto i : order) {
+			uint64_t pos = leafs[i] >> height;
+			uint64_t first = pos & ~(count - 1);
+			SectorItem const* nodes = level ? level + first :
+				data_view_->Items(first, count, buf);
+			GetMklPath(nodes, count, pos - first, paths[i], inner);
+		}
+		height = top;
+	}
 }
 
 void SectorProver::GetMklPaths(std::vector<uint64_t> const& leafs,
 	std::vector<std::vector<SectorItem>>& paths) noexcept {
-	SectorItem* data_items = (SectorItem*)data_view_->data();
-	SectorItem* meta_items = (SectorItem*)meta_view_->data();
+	Tick tick(__FUNCTION__, false);
 	paths.resize(leafs.size());
 	for (auto& leaf : leafs) {
 		assert(leaf < data_count_);
+		(void)leaf;
+	}
+	// one allocation a path, the scratch of the call lives on its stack:
+	// concurrent calls share nothing they write
+	auto mkl_path_len = (size_t)std::log2(data_count_);
+	for (auto& path : paths) {
+		path.reserve(mkl_path_len);
 	}
 	// leaf to meta
-	struct GroupLeaf {
-		std::vector<uint64_t> leafs;
-		std::vector<uint64_t> poss;
-		std::vector<std::vector<SectorItem>> proofs;
-	};
-	std::unordered_map<uint64_t, GroupLeaf> block_leafs;
-	for (auto leaf : leafs) {
-		uint64_t block_index = leaf / block_size_;
-		auto& group_leaf = block_leafs[block_index];
-		group_leaf.leafs.push_back(leaf);
-		group_leaf.poss.push_back(leaf % block_size_);
+	if (tree_view_) {
+		GetTreeMklPaths(leafs, paths);
+	} else {
+		GetBlockMklPaths(leafs, paths);
 	}
 
-	// maybe some leafs exist in same block
-	for (auto block_leaf : block_leafs) {
-		uint64_t block_index = block_leaf.first;
-		SectorItem* begin = data_items + block_index * block_size_;
-		auto block_root = &meta_items[block_index];
-		auto& group_leaf = block_leaf.second;
-
-		GetMklPaths(begin, block_size_, group_leaf.poss, block_root,
-			group_leaf.proofs);
-
-		for (size_t i = 0; i < group_leaf.leafs.size(); ++i) {
-			auto leaf = group_leaf.leafs[i];
-			auto& proof = group_leaf.proofs[i];
-			for (size_t j = 0; j < leafs.size(); ++j) {
-				if (leafs[j] == leaf) {
-					if (paths[j].empty()) {
-						// maybe the leaf duplicate
-						paths[j] = std::move(proof);
-					}
-				}
-			}
+	// meta to root, read from the cached meta tree
+	uint64_t count = meta_count_ - 1;
+	for (size_t i = 0; i < leafs.size(); ++i) {
+		for (uint64_t n = count + leafs[i] / block_size_; n > 1; n /= 2) {
+			paths[i].push_back(meta_tree_[n ^ 1]);
 		}
 	}
-
-	// meta to root
-	std::vector<uint64_t> meta_poss;
-	for (auto leaf : leafs) {
-		uint64_t block_index = leaf / block_size_;
-		meta_poss.push_back(block_index);
-	}
-
-	SectorItem* begin = meta_items;
-	auto meta_root = &meta_items[meta_count_ - 1];
-	GetMklPaths(begin, meta_count_ - 1, meta_poss, meta_root, paths);
 }
 
 std::vector<SectorProof> SectorProver::GenerateProofs(
 	std::vector<uint64_t> const& challenges,
 	SectorProgressCallback const& progress) noexcept {
-	Tick tick(__FUNCTION__);
+	Tick tick(__FUNCTION__, false); // per call, often many at once
 
 	if (challenges.empty()) {
 		SUICIDE("empty challenges");
@@ -396,26 +780,53 @@ std::vector<SectorProof> SectorProver::GenerateProofs(
 
 	std::vector<SectorProof> proofs;
 	proofs.resize(challenges.size());
-	SectorItem* data_items = (SectorItem*)data_view_->data();
+
+	// Dc, Dx, Dy, Dyx, Dyy. Each index depends on the item read before, so
+	// the reads of all challenges go out in three batches: Dc and Dx = Dc-1,
+	// then Dy and Dyx = Dy-1, then Dyy.
+	std::vector<SectorRead> reads;
+	auto read = [&reads](uint64_t n, SectorItem* item) {
+		reads.push_back(SectorRead{ n * sizeof(SectorItem), item,
+			(uint32_t)sizeof(SectorItem) });
+	};
+	auto flush = [this, &reads]() {
+		// elevator order, the items land in their proofs whatever the order
+		std::sort(reads.begin(), reads.end(),
+			[](SectorRead const& a, SectorRead const& b) {
+			return a.offset < b.offset;
+		});
+		if (!data_view_->Read(reads)) {
+			SUICIDE("read data");
+		}
+		reads.clear();
+	};
 
 	std::vector<uint64_t> mkl_leafs;
 	for (size_t i = 0; i < challenges.size(); ++i) {
 		auto c = challenges[i] % data_count_;
 		auto& proof = proofs[i];
-		// Dc, Dx, Dy, Dyx, Dyy
-		proof.node_c = data_items[c];
-		SectorItem const& node_c_1 = (c > 0) ? data_items[c - 1] : data_items[0];		
-		auto cx = node_c_1.get_parent_x(c);
-		auto cy = node_c_1.get_parent_y(c);
-		proof.node_cx = data_items[cx];
-		proof.node_cy = data_items[cy];
-		SectorItem const& node_y_1 = (cy > 0) ? data_items[cy - 1] : data_items[0];
-		auto yx = node_y_1.get_parent_x(cy);
-		auto yy = node_y_1.get_parent_y(cy);
-		proof.node_cyx = data_items[yx];
-		proof.node_cyy = data_items[yy];
+		read(c, &proof.node_c);
+		read((c > 0) ? c - 1 : 0, &proof.node_cx); // node_c_1
 		mkl_leafs.push_back(c);
 	}
+	flush();
+
+	for (size_t i = 0; i < challenges.size(); ++i) {
+		auto c = mkl_leafs[i];
+		auto& proof = proofs[i];
+		auto cy = proof.node_cx.get_parent_y(c);
+		read(cy, &proof.node_cy);
+		read((cy > 0) ? cy - 1 : 0, &proof.node_cyx); // node_y_1
+	}
+	flush();
+
+	for (size_t i = 0; i < challenges.size(); ++i) {
+		auto c = mkl_leafs[i];
+		auto& proof = proofs[i];
+		auto cy = proof.node_cx.get_parent_y(c);
+		read(proof.node_cyx.get_parent_y(cy), &proof.node_cyy);
+	}
+	flush();
 
 	std::vector<std::vector<SectorItem>> mkl_paths;
 	GetMklPaths(mkl_leafs, mkl_paths);
@@ -427,36 +838,115 @@ std::vector<SectorProof> SectorProver::GenerateProofs(
 		assert(proof.mkl_path_c.size() == mkl_path_len);
 	}
 
+	SectorMetrics::Add(kSectorProofsGenerated, proofs.size());
 	return proofs;
 }
 
 std::vector<char> SectorProver::PackProofs(
 	std::vector<SectorProof> const& proofs) noexcept {
-	std::vector<char> ret;
-
-	io::filtering_ostream os;
-	os.push(io::gzip_compressor());
-	os.push(io::back_inserter(ret));
-
 	auto const kItemSize = sizeof(SectorItem::data);
+	auto mkl_path_len = (size_t)std::log2(data_count_);
+
+	SectorProofHeader header;
+	header.magic = kSectorProofMagic;
+	header.version = kSectorProofFlat;
+	header.reserved = 0;
+	header.count = (uint32_t)proofs.size();
+
+	std::vector<char> ret(sizeof(header) +
+		kItemSize * (5 + mkl_path_len) * proofs.size());
+	char* p = ret.data();
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
 	for (auto& proof : proofs) {
-		os.write((char*)proof.node_c.data, kItemSize);
-		os.write((char*)proof.node_cx.data, kItemSize);
-		os.write((char*)proof.node_cy.data, kItemSize);
-		os.write((char*)proof.node_cyx.data, kItemSize);
-		os.write((char*)proof.node_cyy.data, kItemSize);
-		for (auto& i : proof.mkl_path_c) {
-			os.write((char*)i.data, kItemSize);
+		if (proof.mkl_path_c.size() != mkl_path_len) {
+			SUICIDE("mkl_path_c size");
 		}
+		memcpy(p, proof.node_c.data, kItemSize);
+		p += kItemSize;
+		memcpy(p, proof.node_cx.data, kItemSize);
+		p += kItemSize;
+		memcpy(p, proof.node_cy.data, kItemSize);
+		p += kItemSize;
+		memcpy(p, proof.node_cyx.data, kItemSize);
+		p += kItemSize;
+		memcpy(p, proof.node_cyy.data, kItemSize);
+		p += kItemSize;
+		memcpy(p, proof.mkl_path_c.data(), kItemSize * mkl_path_len);
+		p += kItemSize * mkl_path_len;
 	}
 
-	os.reset();
+	return ret;
+}
+
+std::vector<char> SectorProver::PackProofs(
+	std::vector<uint64_t> const& challenges,
+	std::vector<SectorProof> const& proofs) noexcept {
+	if (challenges.size() != proofs.size()) {
+		SUICIDE("challenges and proofs mismatch");
+	}
+
+	std::vector<char> ret;
+	auto write = [&ret](void const* p, size_t size) {
+		ret.insert(ret.end(), (char const*)p, (char const*)p + size);
+	};
+	auto const kItemSize = sizeof(SectorItem::data);
+
+	SectorProofHeader header;
+	header.magic = kSectorProofMagic;
+	header.version = kSectorProofMultiproof;
+	header.reserved = 0;
+	header.count = (uint32_t)challenges.size();
+	write(&header, sizeof(header));
+
+	// pair<position, proof index> of the known nodes of a level
+	std::vector<std::pair<uint64_t, size_t>> nodes;
+	for (size_t i = 0; i < challenges.size(); ++i) {
+		nodes.emplace_back(challenges[i] % data_count_, i);
+	}
+	std::sort(nodes.begin(), nodes.end());
+	nodes.erase(std::unique(nodes.begin(), nodes.end(),
+		[](std::pair<uint64_t, size_t> const& a,
+			std::pair<uint64_t, size_t> const& b) {
+		return a.first == b.first;
+	}), nodes.end());
+
+	for (auto const& node : nodes) {
+		auto const& proof = proofs[node.second];
+		if (node.first % 2 == 0)
+			write(proof.node_cx.data, kItemSize);
+		write(proof.node_cyx.data, kItemSize);
+		write(proof.node_cyy.data, kItemSize);
+	}
+
+	auto mkl_path_len = (int)std::log2(data_count_);
+	for (int height = 0; height < mkl_path_len; ++height) {
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			if (i + 1 < nodes.size() &&
+				nodes[i + 1].first == (nodes[i].first ^ 1)) {
+				++i; // both known, the parent is rebuilt
+				continue;
+			}
+			auto const& path = proofs[nodes[i].second].mkl_path_c;
+			assert(path.size() == (size_t)mkl_path_len);
+			write(path[height].data, kItemSize);
+		}
 
-	size_t raw_size = sizeof(SectorItem::data) * proofs.size() *
-		(5 + 2 * proofs[0].mkl_path_c.size());
+		size_t n = 0;
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			uint64_t parent = nodes[i].first / 2;
+			if (n > 0 && nodes[n - 1].first == parent)
+				continue;
+			nodes[n++] = std::make_pair(parent, nodes[i].second);
+		}
+		nodes.resize(n);
+	}
 
-	std::cout << __FUNCTION__ << ": " << std::to_string(raw_size) << " -> " <<
-		ret.size() << std::endl;
+	size_t raw_size = kItemSize * proofs.size() * (5 + mkl_path_len);
+	if (Tick::console()) {
+		std::cout << __FUNCTION__ << ": " << std::to_string(raw_size) <<
+			" -> " << ret.size() << std::endl;
+	}
 
 	return ret;
 }
@@ -468,23 +958,188 @@ std::vector<char> SectorProver::GeneratePackedProofs(
 		SUICIDE("empty challenges");
 	}
 	auto proofs = GenerateProofs(challenges, progress);
-	return PackProofs(proofs);
+	return PackProofs(challenges, proofs);
+}
+
+// Run fn on blocks [first, last) over a work-stealing pool, stop once any
+// fn returns false. progress is reported in order from any thread.
+bool SectorProver::ForEachBlock(uint64_t first, uint64_t last,
+	std::function<bool(uint64_t block)> const& fn,
+	SectorProgressCallback const& progress, std::string const& desc) noexcept {
+	std::atomic<bool> failed(false);
+	std::atomic<uint64_t> done(0);
+	std::mutex progress_mutex;
+	uint64_t reported = 0;
+	uint64_t const total = last - first;
+	// tasks of at least 64K items
+	uint64_t const grain = std::max<uint64_t>(1, (1 << 16) / block_size_);
+
+	ThreadPool pool(options_.thread_count);
+	pool.ParallelFor(first, last, grain, [&](uint64_t begin, uint64_t end) {
+		for (uint64_t i = begin; i < end; ++i) {
+			if (failed)
+				return;
+			if (!fn(i)) {
+				failed = true;
+				return;
+			}
+
+			uint64_t n = ++done;
+			if (n % 1000 == 0 && progress) {
+				std::lock_guard<std::mutex> lock(progress_mutex);
+				if (n > reported) {
+					reported = n;
+					progress((int)(n * 100 / total),
+						desc + ": " + std::to_string(n));
+				}
+			}
+		}
+	});
+
+	return !failed;
+}
+
+// <sector_id>.ckp next to the meta: blocks [0, block_count) of the data,
+// the meta and the stored levels are on disk
+struct SectorCheckpoint {
+	static uint32_t const kMagic = 0x43536f50; // "PoSC"
+	static uint32_t const kVersion = 0;
+
+	uint32_t magic;
+	uint32_t version;
+	uint64_t data_size;
+	uint64_t stripe_size; // 0 for one data file
+	uint32_t stripe_count;
+	uint32_t tree_level_step;
+	SectorItem prefix;
+	uint64_t block_count;
+	SectorItem last_root; // meta item block_count - 1
+};
+
+// the items of the blocks are synced by the caller
+bool SectorProver::WriteCheckpoint(SectorItem* meta_items,
+	SectorItem* tree_items, uint64_t first_block,
+	uint64_t last_block) noexcept {
+	Tick tick(__FUNCTION__);
+	bool ok = SyncMapped(meta_items + first_block,
+		(last_block - first_block) * sizeof(SectorItem));
+	for (auto const& level : tree_levels_) {
+		uint64_t first = (first_block * block_size_) >> level.first;
+		uint64_t last = (last_block * block_size_) >> level.first;
+		ok = SyncMapped(tree_items + level.second + first,
+			(last - first) * sizeof(SectorItem)) && ok;
+	}
+	if (!ok)
+		return false;
+
+	SectorCheckpoint checkpoint{}; // both items are set below
+	checkpoint.magic = SectorCheckpoint::kMagic;
+	checkpoint.version = SectorCheckpoint::kVersion;
+	checkpoint.data_size = data_size_;
+	if (!options_.stripe_paths.empty()) {
+		checkpoint.stripe_size = options_.stripe_size;
+		checkpoint.stripe_count = (uint32_t)options_.stripe_paths.size();
+	}
+	checkpoint.tree_level_step = options_.tree_level_step;
+	checkpoint.prefix = prefix_;
+	checkpoint.block_count = last_block;
+	checkpoint.last_root = meta_items[last_block - 1];
+	return WriteFileDurable(checkpoint_pathname_, &checkpoint,
+		sizeof(checkpoint));
+}
+
+bool SectorProver::ReadCheckpoint(uint64_t* block_count,
+	SectorItem* last_root) noexcept {
+	SectorCheckpoint checkpoint;
+	std::ifstream file(checkpoint_pathname_, std::ios::binary);
+	if (!file.read((char*)&checkpoint, sizeof(checkpoint)))
+		return false;
+
+	// the files must be the ones this prover would make
+	SectorCheckpoint want{};
+	if (!options_.stripe_paths.empty()) {
+		want.stripe_size = options_.stripe_size;
+		want.stripe_count = (uint32_t)options_.stripe_paths.size();
+	}
+	if (checkpoint.magic != SectorCheckpoint::kMagic ||
+		checkpoint.version != SectorCheckpoint::kVersion ||
+		checkpoint.data_size != data_size_ ||
+		checkpoint.stripe_size != want.stripe_size ||
+		checkpoint.stripe_count != want.stripe_count ||
+		checkpoint.tree_level_step != options_.tree_level_step ||
+		checkpoint.prefix != prefix_ ||
+		checkpoint.block_count == 0 ||
+		checkpoint.block_count > meta_count_ - 1) {
+		return false;
+	}
+	*block_count = checkpoint.block_count;
+	*last_root = checkpoint.last_root;
+	return true;
+}
+
+// every item of [first, last) must follow from the items before it
+bool SectorProver::CheckChain(uint64_t first, uint64_t last) noexcept {
+	SectorStripedView const& items = *data_view_;
+	for (uint64_t n = std::max<uint64_t>(first, 1); n < last; ++n) {
+		SectorItem const& dn_1 = items[n - 1];
+		SectorItem dn;
+		CreateItem(n, items[dn_1.get_parent_x(n)],
+			items[dn_1.get_parent_y(n)], &dn);
+		if (dn != items[n])
+			return false;
+	}
+	return first > 0 || items[0] == d0_;
+}
+
+// rebuild the block from the data, the root must be the one in the meta
+// and the stored levels the rebuilt ones
+bool SectorProver::CheckBlock(uint64_t block) noexcept {
+	SectorStripedView const& data_items = *data_view_;
+	SectorItem const* meta_items = (SectorItem const*)meta_view_->data();
+	SectorMklStack mkl_stack;
+	bool tree_ok = true;
+	if (tree_view_) {
+		mkl_stack.SetLevelSink(TreeLevelMask(), [&](int height,
+			uint64_t index, SectorItem const* nodes, uint64_t count) {
+			auto level = TreeLevel(height);
+			if (memcmp(level + index, nodes, count * sizeof(SectorItem)))
+				tree_ok = false;
+		}, block * block_size_);
+	}
+	uint64_t run = std::min(block_size_, data_items.stripe_count());
+	for (uint64_t n = block * block_size_; n < (block + 1) * block_size_;
+		n += run) {
+		mkl_stack.PushLeafs(&data_items[n], run);
+	}
+	return tree_ok && mkl_stack.root(block_size_) == meta_items[block];
+}
+
+// The sizes only tell that the files are of a sector this size. A meta or
+// tree left from an older Create, or of another user on a shared fast disk,
+// has the right size too: one random block must match, it costs a block
+// read instead of the sqrt(N) of a full check.
+bool SectorProver::CheckPair() noexcept {
+	if ((*data_view_)[0] != d0_)
+		return false;
+
+	std::random_device rd;
+	std::uniform_int_distribution<uint64_t> dist(0, meta_count_ - 2);
+	return CheckBlock(dist(rd));
 }
 
-bool SectorProver::FullCheckIntegrity() noexcept {
+bool SectorProver::FullCheckIntegrity(
+	SectorProgressCallback const& progress) noexcept {
 	Tick tick(__FUNCTION__);
-	SectorItem* data_items = (SectorItem*)data_view_->data();
 	SectorItem* meta_items = (SectorItem*)meta_view_->data();
 	auto & root = mkl_root();
 	SectorItem temp_root;
 
-	for (uint64_t i = 0; i < meta_count_ - 1; ++i) {
-		auto begin = data_items + i * block_size_;
-		CaculateMklRoot(begin, block_size_, &temp_root);
-		if (temp_root != meta_items[i]) {
-			assert(false);
-			return false;
-		}
+	bool blocks_ok = ForEachBlock(0, meta_count_ - 1, [&](uint64_t i) {
+		return CheckBlock(i);
+	}, progress, "check block root");
+	if (!blocks_ok) {
+		assert(false);
+		return false;
 	}
 
 	CaculateMklRoot(meta_items, meta_count_ - 1, &temp_root);
@@ -494,7 +1149,7 @@ bool SectorProver::FullCheckIntegrity() noexcept {
 	}
 
 #if 0 // do not need it
-	CaculateMklRoot(data_items, data_count_, &temp_root);
+	CaculateMklRoot(&(*data_view_)[0], data_count_, &temp_root); // one file
 	if (temp_root != root) {
 		assert(false);
 		return false;
@@ -520,3 +1175,1062 @@ bool SectorProver::FastCheckIntegrity() noexcept {
 	SectorVerifier verifier(user_id_, sector_id_, data_size_, mkl_root());
 	return verifier.VerifyProofs(c, proofs);
 }
+
+// Many threads proving one opened sector, with and without stored levels.
+// Every batch must match the one made alone. Each thread count is a phase
+// "concurrent_proofs_<step>_t<n>" of SectorMetrics, its proofs over its
+// seconds should grow with the threads until the disk or the memory bus is
+// saturated.
+void test_concurrent_proofs() {
+	std::string const path = "./test_concurrent_proofs";
+	std::string const user_id = "abcd";
+	uint64_t const data_size = 16 * kSectorSizeM;
+	uint64_t const data_count = data_size / sizeof(SectorItem);
+	size_t const kChallenges = 256;
+	size_t const kRounds = 16;
+	size_t const max_threads = std::max(2u, std::thread::hardware_concurrency());
+
+	fs::remove_all(path);
+	fs::create_directories(path);
+	for (uint32_t tree_level_step : { 0, 4 }) {
+		SectorOptions options;
+		options.tree_level_step = tree_level_step;
+		options.checkpoint_seconds = 0;
+		std::string sector_id = "step" + std::to_string(tree_level_step);
+		SectorItem root;
+		{
+			SectorProver prover(user_id, sector_id, data_size, path, options);
+			bool ok = prover.Create(nullptr);
+			assert(ok);
+			(void)ok;
+			root = prover.mkl_root();
+		}
+		SectorProver prover(user_id, sector_id, data_size, path, options);
+		bool ok = prover.Open(SectorProver::NoneIntegrityCheck);
+		assert(ok);
+		SectorVerifier verifier(user_id, sector_id, data_size, root);
+
+		// each thread has its challenges, proved alone first
+		std::mt19937_64 rng(tree_level_step);
+		std::vector<std::vector<uint64_t>> challenges(max_threads);
+		std::vector<std::vector<char>> expects(max_threads);
+		for (size_t t = 0; t < max_threads; ++t) {
+			challenges[t].resize(kChallenges);
+			for (auto& c : challenges[t]) c = rng() % data_count;
+			expects[t] = prover.GeneratePackedProofs(challenges[t], nullptr);
+			ok = verifier.VerifyPackedProofs(challenges[t], expects[t]) && ok;
+		}
+		assert(ok);
+
+		for (size_t thread_count = 1; thread_count <= max_threads;
+			thread_count *= 2) {
+			std::atomic<size_t> mismatches(0);
+			{
+				Tick tick("concurrent_proofs_" +
+					std::to_string(tree_level_step) + "_t" +
+					std::to_string(thread_count));
+				std::vector<std::thread> threads;
+				for (size_t t = 0; t < thread_count; ++t) {
+					threads.emplace_back([&, t]() {
+						for (size_t round = 0; round < kRounds; ++round) {
+							auto packed = prover.GeneratePackedProofs(
+								challenges[t], nullptr);
+							if (packed != expects[t])
+								++mismatches;
+						}
+					});
+				}
+				for (auto& thread : threads) {
+					thread.join();
+				}
+			}
+			assert(mismatches == 0);
+		}
+	}
+	fs::remove_all(path);
+}
+
+namespace {
+
+// flip a bit of the item at index n of a file of items
+void CorruptItem(std::string const& pathname, uint64_t n) {
+	std::fstream file(pathname, std::ios::in | std::ios::out | std::ios::binary);
+	char c = 0;
+	file.seekg(n * sizeof(SectorItem));
+	file.read(&c, 1);
+	c ^= 1;
+	file.seekp(n * sizeof(SectorItem));
+	file.write(&c, 1);
+	assert(file.good());
+}
+
+bool SameFile(std::string const& a, std::string const& b) {
+	std::ifstream file_a(a, std::ios::binary), file_b(b, std::ios::binary);
+	return std::equal(std::istreambuf_iterator<char>(file_a),
+		std::istreambuf_iterator<char>(),
+		std::istreambuf_iterator<char>(file_b),
+		std::istreambuf_iterator<char>());
+}
+
+// the item array of striped files equals the one of a plain .dat
+bool SameStriped(std::vector<std::string> const& pathnames,
+	uint64_t stripe_size, std::string const& plain, uint64_t data_size) {
+	std::vector<std::ifstream> files;
+	for (auto const& pathname : pathnames) {
+		files.emplace_back(pathname, std::ios::binary);
+	}
+	std::ifstream plain_file(plain, std::ios::binary);
+	std::vector<char> a(stripe_size), b(stripe_size);
+	for (uint64_t offset = 0; offset < data_size; offset += stripe_size) {
+		uint32_t file;
+		uint64_t file_offset;
+		SectorStripedView::Locate(offset, stripe_size, files.size(), &file,
+			&file_offset);
+		files[file].seekg(file_offset);
+		if (!files[file].read(a.data(), stripe_size) ||
+			!plain_file.read(b.data(), stripe_size) || a != b) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// the blocks a checkpoint says are done, 0 without one
+uint64_t CheckpointBlocks(std::string const& pathname) {
+	SectorCheckpoint checkpoint{};
+	std::ifstream file(pathname, std::ios::binary);
+	if (!file.read((char*)&checkpoint, sizeof(checkpoint)))
+		return 0;
+	return checkpoint.block_count;
+}
+
+// the checkpoint taken back to an earlier block end, whose root is in the
+// meta file
+void RewindCheckpoint(std::string const& pathname,
+	std::string const& meta_pathname, uint64_t block_count) {
+	SectorCheckpoint checkpoint{};
+	std::fstream file(pathname, std::ios::in | std::ios::out | std::ios::binary);
+	file.read((char*)&checkpoint, sizeof(checkpoint));
+	assert(checkpoint.block_count >= block_count);
+	checkpoint.block_count = block_count;
+	std::ifstream meta_file(meta_pathname, std::ios::binary);
+	meta_file.seekg((block_count - 1) * sizeof(SectorItem));
+	meta_file.read((char*)checkpoint.last_root.data, sizeof(SectorItem));
+	file.seekp(0);
+	file.write((char*)&checkpoint, sizeof(checkpoint));
+	assert(file.good() && meta_file.good());
+}
+
+// A Create cut at its second progress report, the first one waits long
+// enough for a checkpoint of the 1 second options in between. The chain
+// reports every 1M items, the sector needs 2M at least.
+bool CreateCut(SectorProver& prover) {
+	int reports = 0;
+	return prover.Create([&reports](int, std::string) {
+		if (++reports == 1)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+		else
+			throw std::runtime_error("cut");
+	});
+}
+
+bool SameProofs(std::vector<SectorProof> const& a,
+	std::vector<SectorProof> const& b) {
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i].node_c != b[i].node_c || a[i].node_cx != b[i].node_cx ||
+			a[i].node_cy != b[i].node_cy || a[i].node_cyx != b[i].node_cyx ||
+			a[i].node_cyy != b[i].node_cyy ||
+			a[i].mkl_path_c != b[i].mkl_path_c) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// the legacy gzip format, as the old PackProofs wrote it
+std::vector<char> GzipProofs(std::vector<SectorProof> const& proofs) {
+	std::vector<char> ret;
+	io::filtering_ostream os;
+	os.push(io::gzip_compressor());
+	os.push(io::back_inserter(ret));
+	auto const kItemSize = sizeof(SectorItem::data);
+	for (auto& proof : proofs) {
+		os.write((char*)proof.node_c.data, kItemSize);
+		os.write((char*)proof.node_cx.data, kItemSize);
+		os.write((char*)proof.node_cy.data, kItemSize);
+		os.write((char*)proof.node_cyx.data, kItemSize);
+		os.write((char*)proof.node_cyy.data, kItemSize);
+		for (auto& i : proof.mkl_path_c) {
+			os.write((char*)i.data, kItemSize);
+		}
+	}
+	os.reset();
+	return ret;
+}
+
+// a 1 MB sector created at path, with a verifier of its root
+struct ProofSector {
+	std::unique_ptr<SectorProver> prover;
+	std::unique_ptr<SectorVerifier> verifier;
+};
+
+ProofSector CreateProofSector(std::string const& path) {
+	std::string const user_id = "abcd";
+	std::string const sector_id = "s";
+	SectorOptions options;
+	options.checkpoint_seconds = 0;
+
+	fs::remove_all(path);
+	fs::create_directories(path);
+	ProofSector sector;
+	sector.prover.reset(new SectorProver(user_id, sector_id, kSectorSizeM,
+		path, options));
+	bool ok = sector.prover->Create(nullptr);
+	assert(ok);
+	(void)ok;
+	sector.verifier.reset(new SectorVerifier(user_id, sector_id, kSectorSizeM,
+		sector.prover->mkl_root()));
+	return sector;
+}
+
+bool VerifySome(SectorProver& prover, std::string const& user_id,
+	std::string const& sector_id, uint64_t data_size, SectorItem const& root) {
+	std::mt19937_64 rng(data_size);
+	std::vector<uint64_t> challenges(64);
+	for (auto& c : challenges) c = rng() % (data_size / sizeof(SectorItem));
+	SectorVerifier verifier(user_id, sector_id, data_size, root);
+	return verifier.VerifyPackedProofs(challenges,
+		prover.GeneratePackedProofs(challenges, nullptr));
+}
+
+} // namespace
+
+// A Create cut after a checkpoint is finished by Resume with the root of an
+// uncut Create. A tail that does not follow from the chain, or a checkpoint
+// of other options, is not resumed and its files stay for a new Create.
+void test_resume() {
+	std::string const path = "./test_resume";
+	std::string const user_id = "abcd";
+	std::string const sector_id = "s";
+	uint64_t const data_size = 64 * kSectorSizeM;
+	uint64_t const data_count = data_size / sizeof(SectorItem);
+	uint64_t const block_size = 1ULL << ((uint64_t)std::log2(data_count) / 2);
+	std::string const data_pathname = path + "/" + sector_id + ".dat";
+	std::string const checkpoint_pathname = path + "/" + sector_id + ".ckp";
+	SectorOptions options;
+	options.tree_level_step = 4;
+	options.checkpoint_seconds = 1;
+
+	fs::remove_all(path);
+	fs::create_directories(path);
+	SectorItem root;
+	{
+		SectorProver prover(user_id, sector_id, data_size, path, options);
+		bool ok = prover.Create(nullptr);
+		assert(ok);
+		(void)ok;
+		root = prover.mkl_root();
+	}
+
+	// cut, then resumed
+	fs::remove_all(path);
+	fs::create_directories(path);
+	{
+		SectorProver prover(user_id, sector_id, data_size, path, options);
+		bool ok = CreateCut(prover);
+		assert(!ok);
+		(void)ok;
+		uint64_t block_count = CheckpointBlocks(checkpoint_pathname);
+		assert(block_count > 0 && block_count < data_count / block_size);
+		(void)block_count;
+		assert(fs::exists(data_pathname));
+	}
+	{
+		SectorProver prover(user_id, sector_id, data_size, path, options);
+		bool ok = prover.Resume(nullptr);
+		assert(ok);
+		assert(prover.mkl_root() == root);
+		assert(!fs::exists(checkpoint_pathname));
+		ok = VerifySome(prover, user_id, sector_id, data_size, root);
+		assert(ok);
+		(void)ok;
+	}
+
+	// the last item of the checkpointed tail is bad
+	fs::remove_all(path);
+	fs::create_directories(path);
+	{
+		SectorProver prover(user_id, sector_id, data_size, path, options);
+		CreateCut(prover);
+		uint64_t block_count = CheckpointBlocks(checkpoint_pathname);
+		assert(block_count > 0);
+		CorruptItem(data_pathname, block_count * block_size - 1);
+	}
+	{
+		SectorProver prover(user_id, sector_id, data_size, path, options);
+		bool ok = prover.Resume(nullptr);
+		assert(!ok);
+		assert(fs::exists(checkpoint_pathname) && fs::exists(data_pathname));
+		ok = prover.Create(nullptr);
+		assert(ok && prover.mkl_root() == root);
+		(void)ok;
+	}
+
+	// a checkpoint of other stored levels
+	fs::remove_all(path);
+	fs::create_directories(path);
+	{
+		SectorProver prover(user_id, sector_id, data_size, path, options);
+		CreateCut(prover);
+		assert(CheckpointBlocks(checkpoint_pathname) > 0);
+	}
+	{
+		SectorOptions other_options = options;
+		other_options.tree_level_step = 0;
+		SectorProver prover(user_id, sector_id, data_size, path,
+			other_options);
+		bool ok = prover.Resume(nullptr);
+		assert(!ok);
+		(void)ok;
+		assert(fs::exists(checkpoint_pathname));
+	}
+	fs::remove_all(path);
+}
+
+// Repair of a sector with one bad item, block root, stored node or top
+// root. The report tells where the regeneration started and what was wrong,
+// the files after it are the ones Create made.
+void test_repair() {
+	std::string const path = "./test_repair";
+	std::string const ref_path = path + "/ref";
+	std::string const user_id = "abcd";
+	std::string const sector_id = "s";
+	uint64_t const data_size = 16 * kSectorSizeM;
+	uint64_t const data_count = data_size / sizeof(SectorItem);
+	uint64_t const block_size = 1ULL << ((uint64_t)std::log2(data_count) / 2);
+	uint64_t const block_count = data_count / block_size;
+	std::vector<std::string> const names = { ".dat", ".mta", ".tre" };
+	SectorOptions options;
+	options.tree_level_step = 4;
+	options.checkpoint_seconds = 0;
+
+	fs::remove_all(path);
+	fs::create_directories(ref_path);
+	SectorItem root;
+	{
+		SectorProver prover(user_id, sector_id, data_size, path, options);
+		bool ok = prover.Create(nullptr);
+		assert(ok);
+		(void)ok;
+		root = prover.mkl_root();
+	}
+	for (auto const& name : names) {
+		fs::copy_file(path + "/" + sector_id + name,
+			ref_path + "/" + sector_id + name);
+	}
+
+	auto repair = [&](SectorRepairReport* report) {
+		SectorProver prover(user_id, sector_id, data_size, path, options);
+		bool ok = prover.Repair(report, nullptr);
+		assert(ok == !report->root_changed);
+		assert(report->block_count == block_count);
+		assert(report->items_regenerated ==
+			(block_count - report->first_bad_block) * block_size);
+		assert(report->blocks_rewritten ==
+			block_count - report->first_bad_block);
+		assert(prover.mkl_root() == root);
+		ok = VerifySome(prover, user_id, sector_id, data_size, root);
+		assert(ok);
+		for (auto const& name : names) {
+			ok = SameFile(path + "/" + sector_id + name,
+				ref_path + "/" + sector_id + name) && ok;
+		}
+		assert(ok);
+		(void)ok;
+	};
+	std::string const data_pathname = path + "/" + sector_id + ".dat";
+	std::string const meta_pathname = path + "/" + sector_id + ".mta";
+	std::string const tree_pathname = path + "/" + sector_id + ".tre";
+
+	// nothing to do
+	SectorRepairReport report;
+	repair(&report);
+	assert(report.first_bad_block == block_count);
+	assert(report.items_rewritten == 0);
+	assert(!report.meta_was_bad && !report.root_changed);
+
+	// an item late in the chain, only it is wrong
+	uint64_t n = data_count / 5 * 4;
+	CorruptItem(data_pathname, n);
+	repair(&report);
+	assert(report.first_bad_block == n / block_size);
+	assert(report.items_rewritten == 1);
+	assert(!report.meta_was_bad && !report.root_changed);
+
+	// an early item, every block is regenerated
+	CorruptItem(data_pathname, 5);
+	repair(&report);
+	assert(report.first_bad_block == 0);
+	assert(report.items_rewritten == 1);
+	assert(!report.meta_was_bad && !report.root_changed);
+
+	// a block root: its block no longer matches, its items are right
+	CorruptItem(meta_pathname, block_count / 2);
+	repair(&report);
+	assert(report.first_bad_block == block_count / 2);
+	assert(report.items_rewritten == 0);
+	assert(report.meta_was_bad && !report.root_changed);
+
+	// a stored node of the first block
+	CorruptItem(tree_pathname, 0);
+	repair(&report);
+	assert(report.first_bad_block == 0);
+	assert(report.items_rewritten == 0);
+	assert(!report.meta_was_bad && !report.root_changed);
+
+	// the top root: the blocks are good, the new root is the one of Create
+	CorruptItem(meta_pathname, block_count);
+	repair(&report);
+	assert(report.first_bad_block == block_count);
+	assert(report.items_rewritten == 0);
+	assert(report.meta_was_bad && report.root_changed);
+	fs::remove_all(path);
+}
+
+// A sector striped over three directories, so the stripes do not divide
+// evenly, has the root and the items of a plain one, in the files where
+// Locate puts them. It proves and passes a full check on Open.
+void test_striping() {
+	std::string const path = "./test_striping";
+	std::string const user_id = "abcd";
+	std::string const sector_id = "s";
+	uint64_t const data_size = 16 * kSectorSizeM;
+	SectorOptions options;
+	options.tree_level_step = 4;
+	options.checkpoint_seconds = 0;
+
+	fs::remove_all(path);
+	fs::create_directories(path + "/plain");
+	fs::create_directories(path + "/meta");
+	SectorItem root;
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/plain",
+			options);
+		bool ok = prover.Create(nullptr);
+		assert(ok);
+		(void)ok;
+		root = prover.mkl_root();
+	}
+
+	SectorOptions striped_options = options;
+	striped_options.stripe_size = 64 * 1024;
+	std::vector<std::string> pathnames;
+	for (int i = 0; i < 3; ++i) {
+		std::string stripe_path = path + "/" + std::to_string(i);
+		fs::create_directories(stripe_path);
+		striped_options.stripe_paths.push_back(stripe_path);
+		pathnames.push_back(stripe_path + "/" + sector_id + "." +
+			std::to_string(i) + ".dat");
+	}
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/meta",
+			path + "/meta", "", striped_options);
+		bool ok = prover.Create(nullptr);
+		assert(ok && prover.mkl_root() == root);
+		(void)ok;
+	}
+	for (size_t i = 0; i < pathnames.size(); ++i) {
+		assert(fs::file_size(pathnames[i]) == SectorStripedView::FileSize(
+			data_size, striped_options.stripe_size, pathnames.size(), i));
+	}
+	assert(!fs::exists(path + "/meta/" + sector_id + ".dat"));
+	bool ok = SameStriped(pathnames, striped_options.stripe_size,
+		path + "/plain/" + sector_id + ".dat", data_size);
+	assert(ok);
+	ok = SameFile(path + "/meta/" + sector_id + ".mta",
+		path + "/plain/" + sector_id + ".mta") &&
+		SameFile(path + "/meta/" + sector_id + ".tre",
+		path + "/plain/" + sector_id + ".tre");
+	assert(ok);
+
+	SectorProver prover(user_id, sector_id, data_size, path + "/meta",
+		path + "/meta", "", striped_options);
+	ok = prover.Open(SectorProver::FullIntegrityCheck, nullptr);
+	assert(ok && prover.mkl_root() == root);
+	ok = VerifySome(prover, user_id, sector_id, data_size, root);
+	assert(ok);
+	(void)ok;
+	fs::remove_all(path);
+}
+
+// A Create under a 4 MB RAM budget, and one cut and resumed under it, also
+// on a half of the ring, make the files of a plain Create. Most older items
+// of the chain are misses of the small cache, the data is written once.
+// A lost write of the ring fails the Create.
+void test_ram_budget() {
+	std::string const path = "./test_ram_budget";
+	std::string const user_id = "abcd";
+	std::string const sector_id = "s";
+	uint64_t const data_size = 64 * kSectorSizeM;
+	std::vector<std::string> const names = { ".dat", ".mta", ".tre" };
+	SectorOptions options;
+	options.tree_level_step = 4;
+	options.checkpoint_seconds = 0;
+
+	fs::remove_all(path);
+	fs::create_directories(path + "/plain");
+	fs::create_directories(path + "/budget");
+	SectorItem root;
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/plain",
+			options);
+		bool ok = prover.Create(nullptr);
+		assert(ok);
+		(void)ok;
+		root = prover.mkl_root();
+	}
+
+	SectorOptions budget_options = options;
+	budget_options.ram_budget = 4 * 1024 * 1024;
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/budget",
+			budget_options);
+		bool ok = prover.Create(nullptr);
+		assert(ok && prover.mkl_root() == root);
+		(void)ok;
+		SectorCacheStats const& stats = prover.cache_stats();
+		assert(stats.hits > 0 && stats.misses > stats.hits);
+		assert(stats.bytes_read == stats.misses * SectorItemCache::kPageSize);
+		assert(stats.bytes_written == data_size);
+		(void)stats;
+	}
+	bool ok = true;
+	for (auto const& name : names) {
+		ok = SameFile(path + "/budget/" + sector_id + name,
+			path + "/plain/" + sector_id + name) && ok;
+	}
+	assert(ok);
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/budget",
+			budget_options);
+		ok = prover.Open(SectorProver::NoneIntegrityCheck);
+		assert(ok);
+		ok = VerifySome(prover, user_id, sector_id, data_size, root);
+		assert(ok);
+	}
+
+	// cut after a checkpoint, resumed under the budget
+	fs::remove_all(path + "/budget");
+	fs::create_directories(path + "/budget");
+	budget_options.checkpoint_seconds = 1;
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/budget",
+			budget_options);
+		CreateCut(prover);
+		assert(CheckpointBlocks(path + "/budget/" + sector_id + ".ckp") > 0);
+	}
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/budget",
+			budget_options);
+		ok = prover.Resume(nullptr);
+		assert(ok && prover.mkl_root() == root);
+		ok = VerifySome(prover, user_id, sector_id, data_size, root);
+		assert(ok);
+	}
+	for (auto const& name : names) {
+		ok = SameFile(path + "/budget/" + sector_id + name,
+			path + "/plain/" + sector_id + name) && ok;
+	}
+	assert(ok);
+
+	// resumed on a half of the ring, 1 MB under budgets below 16 MB: item
+	// n - 1 of the first one made is read through the cache. The budget puts
+	// the page of dy in its slot. The cut checkpoint is past the first 1M.
+	uint64_t const data_count = data_size / sizeof(SectorItem);
+	uint64_t const block_size = 1ULL << ((uint64_t)std::log2(data_count) / 2);
+	uint64_t const half_count = 1024 * 1024 / sizeof(SectorItem);
+	uint64_t const page_count = SectorItemCache::kPageSize / sizeof(SectorItem);
+	uint64_t resume_n = 0;
+	uint64_t slot_count = 0;
+	{
+		SectorStripedView items({ path + "/plain/" + sector_id + ".dat" },
+			data_size, 0, SectorStripedView::kRead);
+		for (uint64_t n = half_count; n < 1000000 && !slot_count;
+			n += half_count) {
+			uint64_t y = items[n - 1].get_parent_y(n);
+			uint64_t distance = (n - 1) / page_count - y / page_count;
+			for (uint64_t slots = 512; slots < 3584 && slots <= distance;
+				++slots) {
+				if (distance % slots == 0) {
+					resume_n = n;
+					slot_count = slots;
+					break;
+				}
+			}
+		}
+	}
+	assert(slot_count);
+	SectorOptions half_options = budget_options;
+	half_options.ram_budget = 2 * 1024 * 1024 +
+		slot_count * SectorItemCache::kPageSize;
+	fs::remove_all(path + "/budget");
+	fs::create_directories(path + "/budget");
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/budget",
+			half_options);
+		CreateCut(prover);
+		RewindCheckpoint(path + "/budget/" + sector_id + ".ckp",
+			path + "/budget/" + sector_id + ".mta",
+			resume_n / block_size);
+	}
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/budget",
+			half_options);
+		ok = prover.Resume(nullptr);
+		assert(ok && prover.mkl_root() == root);
+	}
+	for (auto const& name : names) {
+		ok = SameFile(path + "/budget/" + sector_id + name,
+			path + "/plain/" + sector_id + name) && ok;
+	}
+	assert(ok);
+
+	// the write behind in flight at the first report fails. The checkpoint
+	// after the report, not the ring, collects it: the Create fails still.
+	fs::remove_all(path + "/budget");
+	fs::create_directories(path + "/budget");
+	SectorItemCache::fail_write() = (1000000 / half_count - 1) * half_count;
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/budget",
+			budget_options);
+		int reports = 0;
+		ok = !prover.Create([&reports](int, std::string) {
+			if (++reports == 1)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+		});
+		assert(ok);
+	}
+	ok = SectorItemCache::fail_write() == UINT64_MAX && ok;
+	SectorItemCache::fail_write() = UINT64_MAX;
+	assert(ok);
+	(void)ok;
+	fs::remove_all(path);
+}
+
+// An in_memory Create writes no data file and has the root, meta and tree
+// of a plain one, it proves from RAM. Persist writes the plain .dat, or the
+// stripes, and Open finds them, loaded into RAM or mapped.
+void test_in_memory() {
+	std::string const path = "./test_in_memory";
+	std::string const user_id = "abcd";
+	std::string const sector_id = "s";
+	uint64_t const data_size = 16 * kSectorSizeM;
+	std::vector<std::string> const names = { ".dat", ".mta", ".tre" };
+	SectorOptions options;
+	options.tree_level_step = 4;
+	options.checkpoint_seconds = 0;
+
+	fs::remove_all(path);
+	fs::create_directories(path + "/plain");
+	fs::create_directories(path + "/memory");
+	SectorItem root;
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/plain",
+			options);
+		bool ok = prover.Create(nullptr);
+		assert(ok);
+		(void)ok;
+		root = prover.mkl_root();
+	}
+
+	SectorOptions memory_options = options;
+	memory_options.in_memory = true;
+	std::string const data_pathname = path + "/memory/" + sector_id + ".dat";
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/memory",
+			memory_options);
+		bool ok = prover.Create(nullptr);
+		assert(ok && prover.mkl_root() == root);
+		assert(!fs::exists(data_pathname));
+		ok = VerifySome(prover, user_id, sector_id, data_size, root);
+		assert(ok);
+		ok = prover.Persist(nullptr);
+		assert(ok);
+		ok = VerifySome(prover, user_id, sector_id, data_size, root);
+		assert(ok);
+		(void)ok;
+	}
+	bool ok = true;
+	for (auto const& name : names) {
+		ok = SameFile(path + "/memory/" + sector_id + name,
+			path + "/plain/" + sector_id + name) && ok;
+	}
+	assert(ok);
+
+	// a persisted sector opens into RAM or mapped, Repair is for the latter
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/memory",
+			memory_options);
+		SectorRepairReport report;
+		ok = !prover.Repair(&report, nullptr);
+		assert(ok);
+		ok = prover.Open(SectorProver::FullIntegrityCheck, nullptr);
+		assert(ok && prover.mkl_root() == root);
+		ok = VerifySome(prover, user_id, sector_id, data_size, root);
+		assert(ok);
+	}
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/memory",
+			options);
+		ok = prover.Open(SectorProver::NoneIntegrityCheck);
+		assert(ok && prover.mkl_root() == root);
+		ok = VerifySome(prover, user_id, sector_id, data_size, root);
+		assert(ok);
+	}
+
+	// persisted to stripes
+	SectorOptions striped_options = memory_options;
+	striped_options.stripe_size = 64 * 1024;
+	std::vector<std::string> pathnames;
+	for (int i = 0; i < 2; ++i) {
+		std::string stripe_path = path + "/" + std::to_string(i);
+		fs::create_directories(stripe_path);
+		striped_options.stripe_paths.push_back(stripe_path);
+		pathnames.push_back(stripe_path + "/" + sector_id + "." +
+			std::to_string(i) + ".dat");
+	}
+	fs::create_directories(path + "/striped");
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/striped",
+			striped_options);
+		ok = prover.Create(nullptr);
+		assert(ok && prover.mkl_root() == root);
+		assert(!fs::exists(pathnames[0]) && !fs::exists(pathnames[1]));
+		ok = prover.Persist(nullptr);
+		assert(ok);
+	}
+	ok = SameStriped(pathnames, striped_options.stripe_size,
+		path + "/plain/" + sector_id + ".dat", data_size);
+	assert(ok);
+	{
+		SectorProver prover(user_id, sector_id, data_size, path + "/striped",
+			striped_options);
+		ok = prover.Open(SectorProver::FullIntegrityCheck, nullptr);
+		assert(ok && prover.mkl_root() == root);
+		ok = VerifySome(prover, user_id, sector_id, data_size, root);
+		assert(ok);
+	}
+	(void)ok;
+	fs::remove_all(path);
+}
+
+// Multiproofs of challenge sets with duplicates, siblings, odd and even
+// positions, item 0, the last item and challenges past the end unpack to
+// the proofs GenerateProofs makes and verify. A multiproof cut short, with
+// bytes left over, of other challenges or tampered does not.
+void test_multiproof() {
+	std::string const path = "./test_multiproof";
+	uint64_t const data_count = kSectorSizeM / sizeof(SectorItem);
+	size_t const kItemSize = sizeof(SectorItem);
+
+	auto sector = CreateProofSector(path);
+	SectorProver& prover = *sector.prover;
+	SectorVerifier& verifier = *sector.verifier;
+	bool ok = true;
+
+	std::mt19937_64 rng(9);
+	std::vector<uint64_t> many(1000);
+	for (auto& c : many) c = rng() % data_count;
+	std::vector<std::vector<uint64_t>> const challenge_sets = {
+		{ 7 },
+		{ 8 },
+		{ 0 },
+		{ data_count - 1 },
+		{ 5, 5, 5 },
+		{ 10, 11 },
+		{ 11, 10, 12, 13, 9 },
+		{ 3, data_count + 3, 2 * data_count + 4 },
+		{ 0, 1, data_count - 2, data_count - 1, 0 },
+		many,
+	};
+	for (auto const& challenges : challenge_sets) {
+		auto proofs = prover.GenerateProofs(challenges, nullptr);
+		auto packed = prover.PackProofs(challenges, proofs);
+		ok = verifier.VerifyPackedProofs(challenges, packed) &&
+			SameProofs(verifier.UnpackProof(challenges, packed), proofs);
+		assert(ok);
+		// each sibling once, so never more than the flat format
+		assert(packed.size() <= prover.PackProofs(proofs).size());
+	}
+
+	auto const& challenges = challenge_sets.back();
+	auto packed = prover.GeneratePackedProofs(challenges, nullptr);
+	assert(packed.size() < prover.PackProofs(
+		prover.GenerateProofs(challenges, nullptr)).size() / 2);
+	auto rejected = [&](std::vector<uint64_t> const& c,
+		std::vector<char> const& p) {
+		return !verifier.VerifyPackedProofs(c, p) &&
+			verifier.UnpackProof(c, p).empty();
+	};
+	ok = rejected(challenges, std::vector<char>(packed.begin(),
+		packed.end() - 1));
+	ok = rejected(challenges, std::vector<char>(packed.begin(),
+		packed.end() - kItemSize)) && ok;
+	ok = rejected(challenges, std::vector<char>(packed.begin(),
+		packed.begin() + sizeof(SectorProofHeader))) && ok;
+	auto longer = packed;
+	longer.push_back(0);
+	ok = rejected(challenges, longer) && ok;
+	longer.insert(longer.end(), kItemSize - 1, 0);
+	ok = rejected(challenges, longer) && ok;
+
+	// the count is of the challenges, the layout follows their positions
+	ok = rejected(std::vector<uint64_t>(challenges.begin(),
+		challenges.end() - 1), packed) && ok;
+	auto others = challenges;
+	others[0] ^= 1;
+	ok = !verifier.VerifyPackedProofs(others, packed) && ok;
+
+	// any item, the first and last of the body too
+	for (size_t offset : { sizeof(SectorProofHeader), packed.size() / 2,
+		packed.size() - 1 }) {
+		auto tampered = packed;
+		tampered[offset] ^= 1;
+		ok = !verifier.VerifyPackedProofs(challenges, tampered) && ok;
+	}
+	auto header = packed;
+	header[sizeof(uint32_t)] ^= 1; // version
+	ok = !verifier.VerifyPackedProofs(challenges, header) && ok;
+	assert(ok);
+	(void)ok;
+	fs::remove_all(path);
+}
+
+// The flat format is read in place: the view of a packed batch gives the
+// items of the proofs, unpacks and verifies. A buffer cut short, with bytes
+// left over, of another count, version or path length, or not aligned is
+// not taken.
+void test_flat_proof() {
+	std::string const path = "./test_flat_proof";
+	uint64_t const data_count = kSectorSizeM / sizeof(SectorItem);
+	size_t const mkl_path_len = (size_t)std::log2(data_count);
+	size_t const kItemSize = sizeof(SectorItem);
+
+	auto sector = CreateProofSector(path);
+	SectorProver& prover = *sector.prover;
+	SectorVerifier& verifier = *sector.verifier;
+	bool ok = true;
+
+	std::mt19937_64 rng(10);
+	std::vector<uint64_t> challenges(100);
+	for (auto& c : challenges) c = rng() % data_count;
+	challenges[1] = 0;
+	challenges[2] = challenges[3];
+	auto proofs = prover.GenerateProofs(challenges, nullptr);
+	auto packed = prover.PackProofs(proofs);
+	assert(packed.size() == sizeof(SectorProofHeader) +
+		challenges.size() * (5 + mkl_path_len) * kItemSize);
+
+	SectorProofView view;
+	ok = view.Reset(packed.data(), packed.size(), mkl_path_len) &&
+		view.size() == proofs.size();
+	assert(ok);
+	for (size_t i = 0; i < view.size(); ++i) {
+		auto ref = view[i];
+		ok = *ref.node_c == proofs[i].node_c &&
+			*ref.node_cx == proofs[i].node_cx &&
+			*ref.node_cy == proofs[i].node_cy &&
+			*ref.node_cyx == proofs[i].node_cyx &&
+			*ref.node_cyy == proofs[i].node_cyy &&
+			ref.mkl_path_len == mkl_path_len &&
+			std::equal(ref.mkl_path_c, ref.mkl_path_c + mkl_path_len,
+				proofs[i].mkl_path_c.begin()) && ok;
+		// in place, no copy
+		ok = (char const*)ref.node_c >= packed.data() &&
+			(char const*)(ref.mkl_path_c + mkl_path_len) <=
+			packed.data() + packed.size() && ok;
+	}
+	assert(ok);
+	ok = verifier.VerifyProofs(challenges, view) &&
+		verifier.VerifyPackedProofs(challenges, packed) &&
+		SameProofs(verifier.UnpackProof(packed), proofs) &&
+		SameProofs(verifier.UnpackProof(challenges, packed), proofs);
+	assert(ok);
+
+	auto rejected = [&](std::vector<char> const& p) {
+		SectorProofView v;
+		return !v.Reset(p.data(), p.size(), mkl_path_len) &&
+			!verifier.VerifyPackedProofs(challenges, p) &&
+			verifier.UnpackProof(p).empty();
+	};
+	ok = rejected(std::vector<char>(packed.begin(), packed.end() - 1));
+	ok = rejected(std::vector<char>(packed.begin(),
+		packed.end() - (5 + mkl_path_len) * kItemSize)) && ok;
+	ok = rejected(std::vector<char>(packed.begin(),
+		packed.begin() + sizeof(SectorProofHeader) - 1)) && ok;
+	auto longer = packed;
+	longer.insert(longer.end(), kItemSize, 0);
+	ok = rejected(longer) && ok;
+	SectorProofHeader header;
+	memcpy(&header, packed.data(), sizeof(header));
+	for (int field = 0; field < 3; ++field) {
+		SectorProofHeader bad = header;
+		if (field == 0) bad.magic ^= 1;
+		if (field == 1) bad.version = 3;
+		if (field == 2) bad.count += 1;
+		auto changed = packed;
+		memcpy(changed.data(), &bad, sizeof(bad));
+		ok = rejected(changed) && ok;
+	}
+	ok = !view.Reset(packed.data(), packed.size(), mkl_path_len + 1) && ok;
+	std::vector<uint32_t> words(packed.size() / 4 + 1);
+	char* unaligned = (char*)words.data() + 1;
+	memcpy(unaligned, packed.data(), packed.size());
+	ok = !view.Reset(unaligned, packed.size(), mkl_path_len) && ok;
+
+	// the view takes any items, the verifier finds the tampered ones
+	ok = !verifier.VerifyPackedProofs(std::vector<uint64_t>(
+		challenges.begin(), challenges.end() - 1), packed) && ok;
+	for (size_t offset : { sizeof(SectorProofHeader), packed.size() / 2,
+		packed.size() - 1 }) {
+		auto tampered = packed;
+		tampered[offset] ^= 1;
+		ok = view.Reset(tampered.data(), tampered.size(), mkl_path_len) &&
+			!verifier.VerifyPackedProofs(challenges, tampered) && ok;
+	}
+	assert(ok);
+	(void)ok;
+	fs::remove_all(path);
+}
+
+// Gzip proofs stream one at a time: a batch inflating past the old 1 MB cap
+// verifies and unpacks. More proofs than challenges, fewer, a cut stream or
+// a part of a proof is rejected, and without the challenges a stream that
+// inflates far beyond its size is not inflated at all.
+void test_gzip_proof() {
+	std::string const path = "./test_gzip_proof";
+	uint64_t const data_count = kSectorSizeM / sizeof(SectorItem);
+	size_t const mkl_path_len = (size_t)std::log2(data_count);
+
+	auto sector = CreateProofSector(path);
+	SectorProver& prover = *sector.prover;
+	SectorVerifier& verifier = *sector.verifier;
+	bool ok = true;
+
+	std::mt19937_64 rng(11);
+	std::vector<uint64_t> challenges(2000);
+	for (auto& c : challenges) c = rng() % data_count;
+	auto proofs = prover.GenerateProofs(challenges, nullptr);
+	assert(challenges.size() * (5 + mkl_path_len) * sizeof(SectorItem) >
+		1000000);
+	auto packed = GzipProofs(proofs);
+	ok = verifier.VerifyPackedProofs(challenges, packed) &&
+		SameProofs(verifier.UnpackProof(challenges, packed), proofs) &&
+		SameProofs(verifier.UnpackProof(packed), proofs);
+	assert(ok);
+	std::vector<uint64_t> one(challenges.begin(), challenges.begin() + 1);
+	ok = verifier.VerifyPackedProofs(one, GzipProofs(
+		std::vector<SectorProof>(proofs.begin(), proofs.begin() + 1))) && ok;
+	assert(ok);
+
+	// at most one proof per challenge is inflated
+	auto more = proofs;
+	more.push_back(proofs[0]);
+	ok = !verifier.VerifyPackedProofs(challenges, GzipProofs(more)) &&
+		verifier.UnpackProof(challenges, GzipProofs(more)).empty() && ok;
+	auto fewer = GzipProofs(std::vector<SectorProof>(proofs.begin(),
+		proofs.end() - 1));
+	ok = !verifier.VerifyPackedProofs(challenges, fewer) && ok;
+	ok = !verifier.VerifyPackedProofs(challenges, GzipProofs({})) && ok;
+	ok = verifier.UnpackProof(challenges, GzipProofs({})).empty() && ok;
+	ok = !verifier.VerifyPackedProofs(challenges, std::vector<char>(
+		packed.begin(), packed.end() - 8)) && ok;
+	ok = !verifier.VerifyPackedProofs(challenges, std::vector<char>(
+		packed.begin(), packed.begin() + packed.size() / 2)) && ok;
+	auto part = proofs;
+	part.back().mkl_path_c.pop_back();
+	ok = !verifier.VerifyPackedProofs(challenges, GzipProofs(part)) &&
+		verifier.UnpackProof(challenges, GzipProofs(part)).empty() && ok;
+	auto tampered = proofs;
+	tampered[challenges.size() / 2].node_cyy.data[0] ^= 1;
+	ok = !verifier.VerifyPackedProofs(challenges, GzipProofs(tampered)) && ok;
+	assert(ok);
+
+	// zeros inflate about a thousandfold, hashes hardly at all
+	std::vector<SectorProof> zeros(10000);
+	for (auto& proof : zeros) {
+		proof.node_c = proof.node_cx = proof.node_cy = SectorItem(0);
+		proof.node_cyx = proof.node_cyy = SectorItem(0);
+		proof.mkl_path_c.assign(mkl_path_len, SectorItem(0));
+	}
+	ok = verifier.UnpackProof(GzipProofs(zeros)).empty() && ok;
+	assert(ok);
+	(void)ok;
+	fs::remove_all(path);
+}
+
+// VerifyProofsBatch over more than one lockstep batch: every good proof
+// passes, and proofs tampered in each of their parts at known positions,
+// on batch edges too, fail alone.
+void test_verify_batch() {
+	std::string const path = "./test_verify_batch";
+	uint64_t const data_count = kSectorSizeM / sizeof(SectorItem);
+
+	auto sector = CreateProofSector(path);
+	SectorProver& prover = *sector.prover;
+	SectorVerifier& verifier = *sector.verifier;
+	bool ok = true;
+
+	std::mt19937_64 rng(12);
+	std::vector<uint64_t> challenges(3000);
+	for (auto& c : challenges) c = rng() % data_count;
+	challenges[5] = 0;
+	challenges[1023] |= 1; // odd, node_cx is its path sibling
+	auto proofs = prover.GenerateProofs(challenges, nullptr);
+	auto refs = [](std::vector<SectorProof> const& p) {
+		std::vector<SectorProofRef> ret;
+		for (auto const& proof : p) {
+			ret.push_back(proof.ref());
+		}
+		return ret;
+	};
+	auto passed = verifier.VerifyProofsBatch(challenges, refs(proofs));
+	ok = passed.size() == challenges.size() &&
+		std::find(passed.begin(), passed.end(), false) == passed.end();
+	assert(ok);
+
+	auto tampered = proofs;
+	std::vector<size_t> const bad = { 0, 1, 5, 1023, 1024, 2047, 2999 };
+	tampered[0].node_c.data[0] ^= 1;
+	tampered[1].node_cx.data[7] ^= 1;
+	tampered[5].node_cy.data[3] ^= 1;
+	tampered[1023].mkl_path_c[0].data[1] ^= 1;
+	tampered[1024].node_cyx.data[2] ^= 1;
+	tampered[2047].node_cyy.data[4] ^= 1;
+	tampered[2999].mkl_path_c.back().data[5] ^= 1;
+	auto tampered_refs = refs(tampered);
+	tampered_refs[1500].mkl_path_len -= 1;
+	passed = verifier.VerifyProofsBatch(challenges, tampered_refs);
+	for (size_t i = 0; i < challenges.size(); ++i) {
+		bool want = i != 1500 &&
+			std::find(bad.begin(), bad.end(), i) == bad.end();
+		ok = passed[i] == want && ok;
+	}
+	assert(ok);
+	ok = !verifier.VerifyProofs(challenges, tampered) && ok;
+
+	// a proof under another challenge fails, the count must match
+	auto swapped = challenges;
+	std::swap(swapped[10], swapped[11]);
+	passed = verifier.VerifyProofsBatch(swapped, refs(proofs));
+	ok = !passed[10] && !passed[11] && passed[12] && ok;
+	passed = verifier.VerifyProofsBatch(std::vector<uint64_t>(
+		challenges.begin(), challenges.end() - 1), refs(proofs));
+	ok = passed.size() == proofs.size() &&
+		std::find(passed.begin(), passed.end(), true) == passed.end() && ok;
+	assert(ok);
+	(void)ok;
+	fs::remove_all(path);
+}
@@ -2,23 +2,64 @@
 
 #include "public.h"
 #include "sector_misc.h"
+#include "sector_stripe.h"
+
+class SectorMklStack;
+
+// what SectorProver::Repair found and rewrote
+struct SectorRepairReport {
+	uint64_t block_count = 0;
+	uint64_t first_bad_block = 0; // block_count when all blocks were good
+	uint64_t items_regenerated = 0; // from first_bad_block on
+	uint64_t items_rewritten = 0; // of those, the ones that were wrong
+	uint64_t blocks_rewritten = 0; // block roots and stored levels
+	bool meta_was_bad = false; // the block roots did not give the top root
+	bool root_changed = false; // the stored top root was replaced
+};
 
 class SectorProver : private boost::noncopyable {
 public:
-	// throw
+	// throw, .dat, .mta and .tre all in path
+	SectorProver(std::string user_id, std::string sector_id, uint64_t data_size,
+		std::string path, SectorOptions const& options = SectorOptions());
+
+	// throw, tiered placement: the small .mta (and the .tre of the stored
+	// levels) is read by every proof, put it on a fast disk or tmpfs and the
+	// .dat on bulk storage. An empty tree_path means meta_path
 	SectorProver(std::string user_id, std::string sector_id, uint64_t data_size,
-		std::string path);
+		std::string data_path, std::string meta_path, std::string tree_path = "",
+		SectorOptions const& options = SectorOptions());
 
 	// long time
 	bool Create(SectorProgressCallback const& progress) noexcept;
 
+	// long time, write the items of an in_memory sector to the data files,
+	// so a later Open finds them. The sector stays open.
+	bool Persist(SectorProgressCallback const& progress = nullptr) noexcept;
+
+	// long time, regenerate the items from the first block whose root does
+	// not match the meta on, then the affected block roots and the top root.
+	// False if it failed, or if the top root differs from the stored one:
+	// then compare mkl_root() with the root the verifiers know. Not for
+	// in_memory sectors.
+	bool Repair(SectorRepairReport* report,
+		SectorProgressCallback const& progress) noexcept;
+
+	// long time, continue a Create cut short by a crash or a power loss from
+	// its last checkpoint. The files of a failed Resume stay for another try.
+	bool Resume(SectorProgressCallback const& progress) noexcept;
+
 	enum OpenFlag {
 		NoneIntegrityCheck,
 		FullIntegrityCheck,
 		FastIntegrityCheck,
 	};
-	bool Open(OpenFlag flag) noexcept;
+	bool Open(OpenFlag flag,
+		SectorProgressCallback const& progress = nullptr) noexcept;
 
+	// Many threads may generate proofs of an opened sector at once, each
+	// call reads into its own buffers. Not while Open, Create, Persist,
+	// Repair or Resume run on the same prover.
 	std::vector<SectorProof> GenerateProofs(
 		std::vector<uint64_t> const& challenges,
 		SectorProgressCallback const& progress) noexcept;
@@ -27,31 +68,66 @@ public:
 		std::vector<uint64_t> const& challenges,
 		SectorProgressCallback const& progress) noexcept;
 
+	// flat format, see SectorProofView
 	std::vector<char> PackProofs(
 		std::vector<SectorProof> const& proofs) noexcept;
 
+	// merkle multiproof, see SectorProofHeader
+	std::vector<char> PackProofs(std::vector<uint64_t> const& challenges,
+		std::vector<SectorProof> const& proofs) noexcept;
+
 	SectorItem const& mkl_root() noexcept;
 
+	// of the last InitData under SectorOptions::ram_budget
+	SectorCacheStats const& cache_stats() noexcept;
+
 	SectorItem const& prefix() noexcept;
 
 	SectorItem const& d0() noexcept;
 private:
-	void InitData(SectorProgressCallback const& progress); // throw, sync, long time
+	friend class SectorBatchCreator;
+	friend struct SectorBench; // pospace_bench.cpp
+
+	// throw, sync, long time
+	void InitData(SectorProgressCallback const& progress,
+		uint64_t first_block = 0, uint64_t* rewritten = nullptr);
 	void InitMeta(SectorProgressCallback const& progress); // throw, sync, long time
 	void OpenData(); // throw
 	void OpenMeta(); // throw
+	void OpenTree(); // throw
+	bool BuildMetaTree() noexcept;
+	void AddWantSpaces(std::map<std::string, uint64_t>& want_spaces) const noexcept;
+	void AddDataWantSpaces(
+		std::map<std::string, uint64_t>& want_spaces) const noexcept;
+	template <typename Items>
+	void RunChain(Items& items, SectorItem* meta_items, SectorItem* tree_items,
+		uint64_t first_block, uint64_t* rewritten,
+		SectorProgressCallback const& progress); // throw
+	bool WriteCheckpoint(SectorItem* meta_items, SectorItem* tree_items,
+		uint64_t first_block, uint64_t last_block) noexcept;
+	bool ReadCheckpoint(uint64_t* block_count, SectorItem* last_root) noexcept;
+	bool CheckChain(uint64_t first, uint64_t last) noexcept;
+	void Remove() noexcept;
+	bool CheckBlock(uint64_t block) noexcept;
+	bool CheckPair() noexcept;
+	uint64_t TreeLevelMask() const noexcept;
+	SectorItem const* TreeLevel(int height) const noexcept;
+	void SetTreeSink(SectorMklStack& mkl_stack, SectorItem* tree_items,
+		uint64_t first_leaf) const noexcept;
 	void InitD0() noexcept;
 	void CreateItem(uint64_t n, SectorItem const& dx, SectorItem const& dy,
 		SectorItem* dn) noexcept;
-	void CaculateMklRoot(SectorItem const* begin, uint64_t count,
-		SectorItem* root) noexcept;
 	void GetMklPaths(std::vector<uint64_t> const& leafs,
 		std::vector<std::vector<SectorItem>>& paths) noexcept;
-	void GetMklPaths(SectorItem const* begin, uint64_t count,
-		std::vector<uint64_t> leafs, SectorItem const* root,
+	void GetBlockMklPaths(std::vector<uint64_t> const& leafs,
+		std::vector<std::vector<SectorItem>>& paths) noexcept;
+	void GetTreeMklPaths(std::vector<uint64_t> const& leafs,
 		std::vector<std::vector<SectorItem>>& paths) noexcept;
+	bool ForEachBlock(uint64_t first, uint64_t last,
+		std::function<bool(uint64_t block)> const& fn,
+		SectorProgressCallback const& progress, std::string const& desc) noexcept;
 	// long time
-	bool FullCheckIntegrity() noexcept;
+	bool FullCheckIntegrity(SectorProgressCallback const& progress) noexcept;
 	bool FastCheckIntegrity() noexcept;
 private:
 	std::string const user_id_;
@@ -61,12 +137,27 @@ private:
 	uint64_t const block_size_;
 	uint64_t const meta_size_;
 	uint64_t const meta_count_;
-	std::string const path_;
-	std::string const data_pathname_;
+	std::string const data_path_;
+	std::string const meta_path_;
+	std::string const tree_path_;
+	std::vector<std::string> data_pathnames_; // one per stripe path
 	std::string const meta_pathname_;
+	std::string const tree_pathname_;
+	std::string const checkpoint_pathname_;
 	SectorItem const prefix_;
+	SectorOptions const options_;
+	int block_height_; // block_size_ == 2^block_height_
+	std::vector<std::pair<int, uint64_t>> tree_levels_; // pair<height, offset>
+	uint64_t tree_size_;
 private:
 	SectorItem d0_;
-	std::unique_ptr<io::mapped_file_source> data_view_;
+	SectorCacheStats cache_stats_;
+	std::unique_ptr<SectorStripedView> data_view_; // batched random reads too
+	// in_memory items made by InitData, taken over by OpenData
+	std::unique_ptr<SectorStripedView> data_memory_;
 	std::unique_ptr<io::mapped_file_source> meta_view_;
+	std::unique_ptr<io::mapped_file_source> tree_view_;
+	// meta mkl tree in level order: [1] is the root, node i has the children
+	// 2i and 2i + 1, the block roots are at [meta_count_ - 1, 2 * (meta_count_ - 1))
+	std::vector<SectorItem> meta_tree_;
 };
\ No newline at end of file
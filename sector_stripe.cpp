@@ -0,0 +1,262 @@
+#include "sector_stripe.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// anonymous memory, in the largest pages the system gives
+struct SectorStripedView::Memory {
+	void* data = nullptr;
+	uint64_t size = 0;
+	char const* pages = "memory";
+
+	// throw
+	Memory(uint64_t bytes, int numa_node) : size(bytes) {
+#if defined(_WIN32)
+		SIZE_T large = GetLargePageMinimum();
+		DWORD type = MEM_RESERVE | MEM_COMMIT;
+		if (large && size % large == 0) {
+			// needs SeLockMemoryPrivilege
+			data = numa_node >= 0 ?
+				VirtualAllocExNuma(GetCurrentProcess(), nullptr, (SIZE_T)size,
+					type | MEM_LARGE_PAGES, PAGE_READWRITE, (DWORD)numa_node) :
+				VirtualAlloc(nullptr, (SIZE_T)size, type | MEM_LARGE_PAGES,
+					PAGE_READWRITE);
+			if (data)
+				pages = "large";
+		}
+		if (!data) {
+			data = numa_node >= 0 ?
+				VirtualAllocExNuma(GetCurrentProcess(), nullptr, (SIZE_T)size,
+					type, PAGE_READWRITE, (DWORD)numa_node) :
+				VirtualAlloc(nullptr, (SIZE_T)size, type, PAGE_READWRITE);
+		}
+		if (!data)
+			throw std::runtime_error("memory alloc");
+#elif defined(__linux__)
+		// MAP_HUGETLB takes the page size log2 at MAP_HUGE_SHIFT (26). It
+		// reserves the pages, no MAP_NORESERVE, so a short pool fails here
+		// and not with a SIGBUS on first touch.
+		struct { int shift; char const* name; } const kHugePages[] = {
+			{ 30, "hugetlb 1G" }, { 21, "hugetlb 2M" } };
+		for (auto const& huge : kHugePages) {
+			if (size % ((uint64_t)1 << huge.shift))
+				continue;
+			void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+				(huge.shift << 26), -1, 0);
+			if (p != MAP_FAILED) {
+				data = p;
+				pages = huge.name;
+				break;
+			}
+		}
+		if (!data) {
+			// no reserved huge pages, ask for transparent ones
+			void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				throw std::runtime_error("memory alloc");
+			data = p;
+			if (madvise(data, size, MADV_HUGEPAGE) == 0)
+				pages = "thp";
+		}
+		if (numa_node >= 0) {
+			// MPOL_BIND, before the first touch places the pages
+			unsigned long const kMpolBind = 2;
+			std::vector<unsigned long> mask(numa_node / 64 + 1);
+			mask[numa_node / 64] |= 1UL << (numa_node % 64);
+			if (syscall(__NR_mbind, data, size, kMpolBind, mask.data(),
+				mask.size() * 64 + 1, 0) != 0) {
+				munmap(data, size);
+				throw std::runtime_error("numa bind");
+			}
+		}
+#else
+		(void)numa_node;
+		data = malloc(size);
+		if (!data)
+			throw std::runtime_error("memory alloc");
+#endif
+	}
+
+	~Memory() {
+#if defined(_WIN32)
+		VirtualFree(data, 0, MEM_RELEASE);
+#elif defined(__linux__)
+		munmap(data, size);
+#else
+		free(data);
+#endif
+	}
+};
+
+// throw
+SectorStripedView::SectorStripedView(std::vector<std::string> const& pathnames,
+	uint64_t data_size, uint64_t stripe_size, Mode mode, int numa_node) {
+	size_t const file_count = mode == kMemory ? 1 : pathnames.size();
+	if (file_count == 0) {
+		throw std::runtime_error("no data file");
+	}
+	if (file_count == 1) {
+		stripe_size = data_size;
+	}
+	if (stripe_size < sizeof(SectorItem) ||
+		(stripe_size & (stripe_size - 1)) != 0 ||
+		data_size / stripe_size < file_count) {
+		throw std::runtime_error("invalid stripe_size");
+	}
+
+	uint64_t const stripe_count = stripe_size / sizeof(SectorItem);
+	stripe_height_ = 0;
+	while (((uint64_t)1 << stripe_height_) < stripe_count) ++stripe_height_;
+	stripe_mask_ = stripe_count - 1;
+	stripes_.resize(data_size / stripe_size);
+
+	if (mode == kMemory) {
+		memory_.reset(new Memory(data_size, numa_node));
+		stripes_[0] = (SectorItem*)memory_->data;
+		return;
+	}
+
+	std::vector<char const*> views(file_count);
+	std::vector<uint64_t> sizes(file_count);
+	for (size_t i = 0; i < file_count; ++i) {
+		sizes[i] = FileSize(data_size, stripe_size, file_count, i);
+		io::mapped_file_params params;
+		params.path = pathnames[i];
+		if (mode == kRead) {
+			params.flags = io::mapped_file_base::readonly;
+		} else {
+			params.flags = io::mapped_file_base::readwrite;
+			if (mode == kCreate)
+				params.new_file_size = sizes[i];
+		}
+		files_.emplace_back(new io::mapped_file(params));
+		if (files_[i]->size() != sizes[i])
+			throw std::runtime_error("data size");
+		views[i] = files_[i]->const_data();
+		if (!views[i])
+			throw std::runtime_error("data open");
+
+		SectorItem* items = (SectorItem*)views[i];
+		for (uint64_t s = i, k = 0; s < stripes_.size(); s += file_count, ++k) {
+			stripes_[s] = items + k * stripe_count;
+		}
+	}
+
+	if (mode == kRead) {
+		reader_.reset(new SectorReader(pathnames, views, sizes));
+	}
+}
+
+SectorStripedView::~SectorStripedView() {
+}
+
+uint64_t SectorStripedView::FileSize(uint64_t data_size, uint64_t stripe_size,
+	size_t file_count, size_t i) noexcept {
+	if (file_count == 1)
+		return data_size;
+	uint64_t stripes = data_size / stripe_size;
+	return (stripes / file_count + (i < stripes % file_count)) * stripe_size;
+}
+
+void SectorStripedView::Locate(uint64_t offset, uint64_t stripe_size,
+	size_t file_count, uint32_t* file, uint64_t* file_offset) noexcept {
+	if (file_count == 1) {
+		*file = 0;
+		*file_offset = offset;
+		return;
+	}
+	uint64_t stripe = offset / stripe_size;
+	*file = (uint32_t)(stripe % file_count);
+	*file_offset = stripe / file_count * stripe_size + offset % stripe_size;
+}
+
+uint64_t SectorStripedView::stripe_count() const noexcept {
+	return stripe_mask_ + 1;
+}
+
+SectorItem const* SectorStripedView::Items(uint64_t n, uint64_t count,
+	std::vector<SectorItem>& buf) const noexcept {
+	if ((n >> stripe_height_) == ((n + count - 1) >> stripe_height_))
+		return &(*this)[n];
+
+	buf.resize(count);
+	for (uint64_t done = 0; done < count;) {
+		uint64_t run = std::min(count - done,
+			stripe_count() - ((n + done) & stripe_mask_));
+		memcpy(&buf[done], &(*this)[n + done], run * sizeof(SectorItem));
+		done += run;
+	}
+	return buf.data();
+}
+
+bool SectorStripedView::Read(std::vector<SectorRead> const& reads) noexcept {
+	uint64_t bytes = 0;
+	for (auto const& read : reads) {
+		bytes += read.size;
+	}
+	SectorMetrics::Add(kSectorBytesRead, bytes);
+
+	if (memory_) {
+		for (auto const& read : reads) {
+			if (read.offset + read.size > memory_->size)
+				return false;
+			memcpy(read.buf, (char const*)memory_->data + read.offset,
+				read.size);
+		}
+		return true;
+	}
+	if (!reader_)
+		return false;
+	if (files_.size() == 1)
+		return reader_->Read(reads);
+
+	// in the given order, ascending offsets stay ascending in every file
+	uint64_t const stripe_size = stripe_count() * sizeof(SectorItem);
+	std::vector<SectorRead> file_reads;
+	file_reads.reserve(reads.size());
+	for (auto const& read : reads) {
+		uint64_t offset = read.offset;
+		char* buf = (char*)read.buf;
+		uint32_t left = read.size;
+		while (left) {
+			SectorRead file_read;
+			Locate(offset, stripe_size, files_.size(), &file_read.file,
+				&file_read.offset);
+			uint32_t size = (uint32_t)std::min<uint64_t>(left,
+				stripe_size - offset % stripe_size);
+			file_read.buf = buf;
+			file_read.size = size;
+			file_reads.push_back(file_read);
+			offset += size;
+			buf += size;
+			left -= size;
+		}
+	}
+	return reader_->Read(file_reads);
+}
+
+char const* SectorStripedView::backend() const noexcept {
+	if (memory_)
+		return memory_->pages;
+	return reader_ ? reader_->backend() : "mmap";
+}
+
+bool SectorStripedView::Sync(uint64_t n, uint64_t count) noexcept {
+	if (memory_)
+		return false; // nothing to make durable
+	bool ok = true;
+	for (uint64_t done = 0; done < count;) {
+		uint64_t run = std::min(count - done,
+			stripe_count() - ((n + done) & stripe_mask_));
+		ok = SyncMapped(&(*this)[n + done], run * sizeof(SectorItem)) && ok;
+		done += run;
+	}
+	return ok;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "public.h"
+#include "sector_misc.h"
+#include "sector_io.h"
+
+// The item array of a sector, striped over files on different disks.
+// Stripe s (stripe_size bytes) is in file s % M at (s / M) * stripe_size,
+// so a sequential pass keeps all the disks busy and random reads spread
+// over them. With one file it is the plain .dat layout. In kMemory the
+// items are in anonymous huge pages instead, and the files are not touched.
+class SectorStripedView : private boost::noncopyable {
+public:
+	enum Mode {
+		kRead,
+		kWrite, // the files exist, e.g. to resume a creation
+		kCreate,
+		kMemory, // RAM only, see SectorOptions::in_memory
+	};
+
+	// throw, numa_node is for kMemory, -1 for any
+	SectorStripedView(std::vector<std::string> const& pathnames,
+		uint64_t data_size, uint64_t stripe_size, Mode mode,
+		int numa_node = -1);
+
+	~SectorStripedView();
+
+	// bytes of file i, stripe_size is ignored for one file
+	static uint64_t FileSize(uint64_t data_size, uint64_t stripe_size,
+		size_t file_count, size_t i) noexcept;
+
+	// file and offset in it of a byte of the item array, the bytes up to the
+	// end of its stripe follow it there
+	static void Locate(uint64_t offset, uint64_t stripe_size,
+		size_t file_count, uint32_t* file, uint64_t* file_offset) noexcept;
+
+	SectorItem& operator[](uint64_t n) noexcept {
+		return stripes_[n >> stripe_height_][n & stripe_mask_];
+	}
+
+	SectorItem const& operator[](uint64_t n) const noexcept {
+		return stripes_[n >> stripe_height_][n & stripe_mask_];
+	}
+
+	// items in a stripe, runs of this many (2^x) items are contiguous
+	uint64_t stripe_count() const noexcept;
+
+	// items [n, n + count) in place when they are in one stripe, else
+	// copied to buf
+	SectorItem const* Items(uint64_t n, uint64_t count,
+		std::vector<SectorItem>& buf) const noexcept;
+
+	// offsets are of the whole item array, a read may cross stripes.
+	// false if not opened for reading or some read failed
+	bool Read(std::vector<SectorRead> const& reads) noexcept;
+
+	// see SectorReader, or the pages of kMemory: "hugetlb 1G",
+	// "hugetlb 2M", "thp" or "memory"
+	char const* backend() const noexcept;
+
+	// write items [n, n + count) back to the disks, see SyncMapped
+	bool Sync(uint64_t n, uint64_t count) noexcept;
+
+private:
+	struct Memory;
+
+private:
+	std::vector<std::unique_ptr<io::mapped_file>> files_;
+	std::unique_ptr<Memory> memory_;
+	std::vector<SectorItem*> stripes_;
+	int stripe_height_; // stripe_count() == 2^stripe_height_
+	uint64_t stripe_mask_;
+	std::unique_ptr<SectorReader> reader_;
+};
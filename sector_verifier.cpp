@@ -42,44 +42,126 @@ bool SectorVerifier::VerifyProofs(std::vector<uint64_t> const& challenges,
 		return false;
 	}
 
-	for (size_t i = 0; i < challenges.size(); ++i) {
-		auto c = challenges[i] % data_count_;
-		auto const& proof = proofs[i];
-		if (!VerifyProof(c, proof))
-			return false;
+	std::vector<SectorProofRef> refs;
+	refs.reserve(proofs.size());
+	for (auto const& proof : proofs) {
+		refs.push_back(proof.ref());
 	}
+	auto passed = VerifyProofsBatch(challenges, refs);
+	return std::find(passed.begin(), passed.end(), false) == passed.end();
+}
 
-	return true;
+bool SectorVerifier::VerifyProofs(std::vector<uint64_t> const& challenges,
+	SectorProofView const& proofs) noexcept {
+	if (challenges.empty()) // let it crash
+		SUICIDE("empty challenges");
+
+	if (proofs.size() != challenges.size())
+		return false;
+
+	std::vector<SectorProofRef> refs;
+	refs.reserve(proofs.size());
+	for (size_t i = 0; i < proofs.size(); ++i) {
+		refs.push_back(proofs[i]);
+	}
+	auto passed = VerifyProofsBatch(challenges, refs);
+	return std::find(passed.begin(), passed.end(), false) == passed.end();
+}
+
+std::vector<bool> SectorVerifier::VerifyProofsBatch(
+	std::vector<uint64_t> const& challenges,
+	std::vector<SectorProofRef> const& proofs) noexcept {
+	Tick tick(__FUNCTION__, false);
+	std::vector<bool> ret(proofs.size(), false);
+	if (proofs.size() != challenges.size())
+		return ret;
+	SectorMetrics::Add(kSectorProofsVerified, proofs.size());
+
+	auto const mkl_path_len = (size_t)std::log2(data_count_);
+	size_t const kBatchSize = 1024;
+	std::vector<SectorItem> pairs(kBatchSize * 4);
+	std::vector<SectorItem> nodes(kBatchSize);
+	std::vector<uint64_t> poss(kBatchSize);
+	std::vector<char> oks(kBatchSize);
+
+	for (size_t first = 0; first < proofs.size(); first += kBatchSize) {
+		size_t const n = std::min(kBatchSize, proofs.size() - first);
+		SectorProofRef const* batch = proofs.data() + first;
+
+		// node_c and node_cy of every proof, as CreateItem
+		for (size_t i = 0; i < n; ++i) {
+			auto const& proof = batch[i];
+			auto c = challenges[first + i] % data_count_;
+			auto y = proof.node_cx->get_parent_y(c);
+			SectorItem::Xor(prefix_, *proof.node_cx, &pairs[i * 4]);
+			SectorItem::Xor(SectorItem(c), *proof.node_cy, &pairs[i * 4 + 1]);
+			SectorItem::Xor(prefix_, *proof.node_cyx, &pairs[i * 4 + 2]);
+			SectorItem::Xor(SectorItem(y), *proof.node_cyy, &pairs[i * 4 + 3]);
+			poss[i] = c;
+		}
+		SectorItem::CompressTwoBatch(pairs.data(), n * 2, pairs.data());
+
+		for (size_t i = 0; i < n; ++i) {
+			auto const& proof = batch[i];
+			auto c = poss[i];
+			auto y = proof.node_cx->get_parent_y(c);
+			auto const& node_c = (c > 0) ? pairs[i * 2] : d0_;
+			auto const& node_y = (y > 0) ? pairs[i * 2 + 1] : d0_;
+			oks[i] = node_c == *proof.node_c && node_y == *proof.node_cy &&
+				proof.mkl_path_len == mkl_path_len &&
+				(c % 2 == 0 || *proof.node_cx == proof.mkl_path_c[0]);
+			nodes[i] = node_c;
+		}
+
+		// failed proofs keep their lane with dummy siblings
+		for (size_t height = 0; height < mkl_path_len; ++height) {
+			for (size_t i = 0; i < n; ++i) {
+				auto const& sibling = oks[i] ?
+					batch[i].mkl_path_c[height] : nodes[i];
+				bool right = (poss[i] >> height) % 2;
+				pairs[i * 2] = right ? sibling : nodes[i];
+				pairs[i * 2 + 1] = right ? nodes[i] : sibling;
+			}
+			SectorItem::CompressTwoBatch(pairs.data(), n, nodes.data());
+		}
+
+		for (size_t i = 0; i < n; ++i) {
+			ret[first + i] = oks[i] && nodes[i] == mkl_root_;
+		}
+	}
+
+	return ret;
 }
 
 bool SectorVerifier::VerifyProof(uint64_t challenge,
-	SectorProof const& proof) noexcept {
+	SectorProofRef const& proof) noexcept {
 	auto c = challenge % data_count_;
 	SectorItem node_c;
 	if (c > 0) {
-		CreateItem(c, proof.node_cx, proof.node_cy, &node_c);
+		CreateItem(c, *proof.node_cx, *proof.node_cy, &node_c);
 	} else {
 		node_c = d0_;
 	}
-	if (node_c != proof.node_c)
+	if (node_c != *proof.node_c)
 		return false;
 
-	auto x = proof.node_cx.get_parent_x(c);
-	auto y = proof.node_cx.get_parent_y(c);
+	auto x = proof.node_cx->get_parent_x(c);
+	auto y = proof.node_cx->get_parent_y(c);
 	SectorItem node_y;
 	if (y > 0) {
-		CreateItem(y, proof.node_cyx, proof.node_cyy, &node_y);
+		CreateItem(y, *proof.node_cyx, *proof.node_cyy, &node_y);
 	} else {
 		node_y = d0_;
 	}
-	if (node_y != proof.node_cy)
+	if (node_y != *proof.node_cy)
 		return false;
 
-	if (!VerifyMklPath(node_c, c, mkl_root_, proof.mkl_path_c))
+	if (!VerifyMklPath(node_c, c, mkl_root_, proof.mkl_path_c,
+		proof.mkl_path_len))
 		return false;
 
 	if (c % 2) {
-		if (proof.node_cx != proof.mkl_path_c[0])
+		if (proof.mkl_path_len == 0 || *proof.node_cx != proof.mkl_path_c[0])
 			return false;
 	}
 
@@ -87,13 +169,13 @@ bool SectorVerifier::VerifyProof(uint64_t challenge,
 }
 
 bool SectorVerifier::VerifyMklPath(SectorItem const& leaf, uint64_t pos,
-	SectorItem const& root, std::vector<SectorItem> const& path) noexcept {
+	SectorItem const& root, SectorItem const* path, size_t path_len) noexcept {
 	SectorItem cacu_root = leaf;
-	for (auto const& p : path) {
+	for (size_t i = 0; i < path_len; ++i) {
 		if (pos % 2) {
-			SectorItem::CompressTwo(p, cacu_root, &cacu_root);
+			SectorItem::CompressTwo(path[i], cacu_root, &cacu_root);
 		} else {
-			SectorItem::CompressTwo(cacu_root, p, &cacu_root);
+			SectorItem::CompressTwo(cacu_root, path[i], &cacu_root);
 		}
 		pos /= 2;
 	}
@@ -101,6 +183,20 @@ bool SectorVerifier::VerifyMklPath(SectorItem const& leaf, uint64_t pos,
 	return (cacu_root == root);
 }
 
+static bool IsGzipProof(std::vector<char> const& packed_proof) {
+	return packed_proof.size() >= 2 && (uint8_t)packed_proof[0] == 0x1f &&
+		(uint8_t)packed_proof[1] == 0x8b;
+}
+
+static bool IsMultiproof(std::vector<char> const& packed_proof) {
+	SectorProofHeader header;
+	if (packed_proof.size() < sizeof(header))
+		return false;
+	memcpy(&header, packed_proof.data(), sizeof(header));
+	return header.magic == kSectorProofMagic &&
+		header.version == kSectorProofMultiproof;
+}
+
 bool SectorVerifier::VerifyPackedProofs(
 	std::vector<uint64_t> const& challenges,
 	std::vector<char> const& packed_proofs) noexcept {
@@ -110,66 +206,269 @@ bool SectorVerifier::VerifyPackedProofs(
 		SUICIDE("empty challenges");
 	}
 
-	auto proofs = UnpackProof(packed_proofs);
-	if (proofs.size() != challenges.size()) {
-		assert(false);
-		return false;
+	if (IsGzipProof(packed_proofs)) {
+		size_t count = 0;
+		if (!ForEachGzipProof(packed_proofs, challenges.size(),
+			[&](size_t i, SectorProofRef const& proof) {
+			return VerifyProof(challenges[i], proof);
+		}, &count))
+			return false;
+		return count == challenges.size();
+	}
+
+	if (!IsMultiproof(packed_proofs)) {
+		SectorProofView view;
+		if (!view.Reset(packed_proofs.data(), packed_proofs.size(),
+			(size_t)std::log2(data_count_)))
+			return false;
+		return VerifyProofs(challenges, view);
 	}
-	return VerifyProofs(challenges, proofs);
+
+	// the multiproof rebuilds every derivable node while unpacking, so
+	// only the root is left to check
+	std::vector<SectorProof> proofs;
+	SectorItem root;
+	if (!UnpackMultiproof(challenges, packed_proofs, proofs, &root))
+		return false;
+	return root == mkl_root_;
 }
 
 std::vector<SectorProof> SectorVerifier::UnpackProof(
+	std::vector<uint64_t> const& challenges,
 	std::vector<char> const& packed_proof) noexcept {
-	std::vector<SectorProof> ret;
+	if (IsGzipProof(packed_proof))
+		return UnpackGzipProof(packed_proof, challenges.size());
+	if (!IsMultiproof(packed_proof))
+		return UnpackProof(packed_proof);
+
+	std::vector<SectorProof> proofs;
+	SectorItem root;
+	if (!UnpackMultiproof(challenges, packed_proof, proofs, &root))
+		proofs.clear();
+	return proofs;
+}
+
+bool SectorVerifier::UnpackMultiproof(std::vector<uint64_t> const& challenges,
+	std::vector<char> const& packed_proof,
+	std::vector<SectorProof>& proofs, SectorItem* root) noexcept {
 	auto const kItemSize = sizeof(SectorItem::data);
+	if (challenges.empty())
+		return false;
 
-	std::vector<char> raw_proofs;
-	try {
-		// avoid zip bomb
-		size_t limit = std::min<size_t>(packed_proof.size() * 10, 1000000);
-		io::filtering_istream is;
-		is.push(io::gzip_decompressor());
-		is.push(io::array_source(packed_proof.data(),	packed_proof.size()));
-		while (is) {
-			char buf[4096];
-			is.read(buf, sizeof(buf));
-			if (raw_proofs.size() + is.gcount() >= limit) {
-				return ret;
+	SectorProofHeader header;
+	if (packed_proof.size() < sizeof(header))
+		return false;
+	memcpy(&header, packed_proof.data(), sizeof(header));
+	if (header.magic != kSectorProofMagic ||
+		header.version != kSectorProofMultiproof ||
+		header.count != challenges.size())
+		return false;
+
+	char const* begin = packed_proof.data() + sizeof(header);
+	char const* end = packed_proof.data() + packed_proof.size();
+	auto read = [&](SectorItem* item) {
+		if ((size_t)(end - begin) < kItemSize)
+			return false;
+		memcpy(item->data, begin, kItemSize);
+		begin += kItemSize;
+		return true;
+	};
+
+	struct Node {
+		uint64_t pos;
+		size_t proof; // the first proof of the position
+		SectorItem item;
+	};
+	std::vector<Node> nodes;
+	for (size_t i = 0; i < challenges.size(); ++i) {
+		nodes.push_back(Node{ challenges[i] % data_count_, i, SectorItem() });
+	}
+	std::sort(nodes.begin(), nodes.end(), [](Node const& a, Node const& b) {
+		return a.pos < b.pos || (a.pos == b.pos && a.proof < b.proof);
+	});
+	nodes.erase(std::unique(nodes.begin(), nodes.end(),
+		[](Node const& a, Node const& b) {
+		return a.pos == b.pos;
+	}), nodes.end());
+	std::vector<Node> const leafs = nodes;
+
+	proofs.clear();
+	proofs.resize(challenges.size());
+	for (auto const& node : nodes) {
+		auto& proof = proofs[node.proof];
+		if (node.pos % 2 == 0 && !read(&proof.node_cx))
+			return false;
+		if (!read(&proof.node_cyx) || !read(&proof.node_cyy))
+			return false;
+	}
+
+	// node_cy and node_c, as VerifyProof checks them
+	auto derive = [this, &proofs](Node& node) {
+		auto& proof = proofs[node.proof];
+		auto y = proof.node_cx.get_parent_y(node.pos);
+		if (y > 0) {
+			CreateItem(y, proof.node_cyx, proof.node_cyy, &proof.node_cy);
+		} else {
+			proof.node_cy = d0_;
+		}
+		if (node.pos > 0) {
+			CreateItem(node.pos, proof.node_cx, proof.node_cy, &proof.node_c);
+		} else {
+			proof.node_c = d0_;
+		}
+		node.item = proof.node_c;
+	};
+
+	// pair<position, item> of every node a path uses, per level
+	auto mkl_path_len = (int)std::log2(data_count_);
+	std::vector<std::vector<std::pair<uint64_t, SectorItem>>> levels(
+		mkl_path_len);
+	std::vector<SectorItem> pairs;
+	for (int height = 0; height < mkl_path_len; ++height) {
+		auto& level = levels[height];
+		pairs.clear();
+		size_t n = 0;
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			auto& node = nodes[i];
+			SectorItem sibling;
+			bool paired = i + 1 < nodes.size() &&
+				nodes[i + 1].pos == (node.pos ^ 1);
+			if (!paired && !read(&sibling))
+				return false;
+			if (height == 0) {
+				// node_cx of an odd challenge is its left sibling
+				if (node.pos % 2)
+					proofs[node.proof].node_cx = sibling;
+				derive(node);
+				if (paired) {
+					proofs[nodes[i + 1].proof].node_cx = node.item;
+					derive(nodes[i + 1]);
+				}
 			}
-			raw_proofs.insert(raw_proofs.end(), buf, buf + is.gcount());
+			if (paired)
+				sibling = nodes[i + 1].item;
+
+			bool left = node.pos % 2 == 0;
+			pairs.push_back(left ? node.item : sibling);
+			pairs.push_back(left ? sibling : node.item);
+			level.emplace_back(node.pos & ~1ULL, pairs[pairs.size() - 2]);
+			level.emplace_back(node.pos | 1, pairs[pairs.size() - 1]);
+			nodes[n++] = Node{ node.pos / 2, node.proof, SectorItem() };
+			if (paired)
+				++i;
+		}
+		nodes.resize(n);
+		SectorItem::CompressTwoBatch(pairs.data(), n, pairs.data());
+		for (size_t i = 0; i < n; ++i) {
+			nodes[i].item = pairs[i];
 		}
-	} catch (std::exception&) {
-		return ret;
 	}
+	if (begin != end || nodes.size() != 1)
+		return false;
+	*root = nodes[0].item;
 
-	auto mkl_path_len = (uint64_t)std::log2(data_count_);
-	auto proof_len = kItemSize * (mkl_path_len + 5);
+	for (auto const& leaf : leafs) {
+		auto& path = proofs[leaf.proof].mkl_path_c;
+		path.resize(mkl_path_len);
+		for (int height = 0; height < mkl_path_len; ++height) {
+			auto const& level = levels[height];
+			uint64_t sibling = (leaf.pos >> height) ^ 1;
+			auto it = std::lower_bound(level.begin(), level.end(),
+				sibling, [](std::pair<uint64_t, SectorItem> const& a,
+					uint64_t pos) {
+				return a.first < pos;
+			});
+			assert(it != level.end() && it->first == sibling);
+			path[height] = it->second;
+		}
+	}
 
-	if (raw_proofs.empty() || raw_proofs.size() % proof_len)
-		return ret;
+	// duplicate challenges share the proof of their position
+	for (size_t i = 0; i < challenges.size(); ++i) {
+		auto pos = challenges[i] % data_count_;
+		auto it = std::lower_bound(leafs.begin(), leafs.end(), pos,
+			[](Node const& a, uint64_t pos) {
+			return a.pos < pos;
+		});
+		if (it->proof != i)
+			proofs[i] = proofs[it->proof];
+	}
+	return true;
+}
 
-	auto proof_count = raw_proofs.size() / proof_len;
+std::vector<SectorProof> SectorVerifier::UnpackProof(
+	std::vector<char> const& packed_proof) noexcept {
+	if (IsGzipProof(packed_proof)) {
+		// avoid zip bomb, hashes hardly compress
+		size_t proof_len = sizeof(SectorItem) *
+			((size_t)std::log2(data_count_) + 5);
+		return UnpackGzipProof(packed_proof,
+			packed_proof.size() * 10 / proof_len);
+	}
 
-	ret.resize(proof_count);
+	std::vector<SectorProof> ret;
+	SectorProofView view;
+	if (!view.Reset(packed_proof.data(), packed_proof.size(),
+		(size_t)std::log2(data_count_)))
+		return ret;
+	ret.reserve(view.size());
+	for (size_t i = 0; i < view.size(); ++i) {
+		ret.push_back(view.to_proof(i));
+	}
+	return ret;
+}
 
-	uint8_t* begin = (uint8_t*)raw_proofs.data();
-	for (auto& proof : ret) {		
-		memcpy(proof.node_c.data, begin, kItemSize);
-		begin += kItemSize;
-		memcpy(proof.node_cx.data, begin, kItemSize);
-		begin += kItemSize;
-		memcpy(proof.node_cy.data, begin, kItemSize);
-		begin += kItemSize;
-		memcpy(proof.node_cyx.data, begin, kItemSize);
-		begin += kItemSize;
-		memcpy(proof.node_cyy.data, begin, kItemSize);
-		begin += kItemSize;
+std::vector<SectorProof> SectorVerifier::UnpackGzipProof(
+	std::vector<char> const& packed_proof, size_t max_count) noexcept {
+	std::vector<SectorProof> ret;
+	SectorProof proof;
+	bool ok = ForEachGzipProof(packed_proof, max_count,
+		[&](size_t, SectorProofRef const& ref) {
+		proof.node_c = *ref.node_c;
+		proof.node_cx = *ref.node_cx;
+		proof.node_cy = *ref.node_cy;
+		proof.node_cyx = *ref.node_cyx;
+		proof.node_cyy = *ref.node_cyy;
+		proof.mkl_path_c.assign(ref.mkl_path_c,
+			ref.mkl_path_c + ref.mkl_path_len);
+		ret.push_back(proof);
+		return true;
+	}, nullptr);
+	if (!ok)
+		ret.clear();
+	return ret;
+}
+
+// Inflate one proof at a time into the same buffer, fn sees proof i in
+// place. At most max_count proofs are inflated, so memory and work stay
+// bounded whatever the stream holds.
+bool SectorVerifier::ForEachGzipProof(std::vector<char> const& packed_proof,
+	size_t max_count,
+	std::function<bool(size_t i, SectorProofRef const& proof)> const& fn,
+	size_t* count) noexcept {
+	auto mkl_path_len = (size_t)std::log2(data_count_);
+	std::vector<SectorItem> items(mkl_path_len + 5);
+	auto proof_len = (std::streamsize)(sizeof(SectorItem) * items.size());
+	SectorProofRef const ref{ &items[0], &items[1], &items[2], &items[3],
+		&items[4], &items[5], mkl_path_len };
 
-		proof.mkl_path_c.resize(mkl_path_len);
-		for (size_t i = 0; i < mkl_path_len; ++i) {
-			memcpy(proof.mkl_path_c[i].data, begin, kItemSize);
-			begin += kItemSize;
+	try {
+		io::filtering_istream is;
+		is.push(io::gzip_decompressor());
+		is.push(io::array_source(packed_proof.data(), packed_proof.size()));
+		for (size_t i = 0;; ++i) {
+			is.read((char*)items.data(), proof_len);
+			if (is.gcount() == 0 && is.eof()) {
+				if (count)
+					*count = i;
+				return i > 0;
+			}
+			if (is.gcount() != proof_len || i >= max_count)
+				return false;
+			if (!fn(i, ref))
+				return false;
 		}
+	} catch (std::exception&) {
+		return false;
 	}
-	return ret;
 }
\ No newline at end of file
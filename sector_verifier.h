@@ -3,28 +3,54 @@
 #include "public.h"
 #include "sector_misc.h"
 
+// The verify calls leave the verifier unchanged, one verifier may serve
+// many threads.
 class SectorVerifier : private boost::noncopyable {
 public:
 	// throw
 	SectorVerifier(std::string user_id, std::string sector_id, uint64_t data_size,
 		SectorItem const& mkl_root);
 
+	// flat or legacy gzip format
 	std::vector<SectorProof> UnpackProof(
 		std::vector<char> const& packed_proof) noexcept;
 
+	// any format, the multiproof needs the challenges
+	std::vector<SectorProof> UnpackProof(
+		std::vector<uint64_t> const& challenges,
+		std::vector<char> const& packed_proof) noexcept;
+
 	bool VerifyProofs(std::vector<uint64_t> const& challenges,
 		std::vector<SectorProof> const& proofs) noexcept;
 
+	bool VerifyProofs(std::vector<uint64_t> const& challenges,
+		SectorProofView const& proofs) noexcept;
+
 	bool VerifyPackedProofs(std::vector<uint64_t> const& challenges,
 		std::vector<char> const& packed_proofs) noexcept;
 
+	// result[i] tells whether proof i passed. The proofs run level by level
+	// in lockstep, each level is one multi-lane hash batch.
+	std::vector<bool> VerifyProofsBatch(std::vector<uint64_t> const& challenges,
+		std::vector<SectorProofRef> const& proofs) noexcept;
+
 private:
 	void InitD0() noexcept;
 	void CreateItem(uint64_t n, SectorItem const& dx, SectorItem const& dy,
 		SectorItem* dn) noexcept;
-	bool VerifyProof(uint64_t challenge, SectorProof const& proof) noexcept;
+	bool VerifyProof(uint64_t challenge, SectorProofRef const& proof) noexcept;
 	bool VerifyMklPath(SectorItem const& leaf, uint64_t pos,
-		SectorItem const& root, std::vector<SectorItem> const& path) noexcept;
+		SectorItem const& root, SectorItem const* path,
+		size_t path_len) noexcept;
+	std::vector<SectorProof> UnpackGzipProof(
+		std::vector<char> const& packed_proof, size_t max_count) noexcept;
+	bool ForEachGzipProof(std::vector<char> const& packed_proof,
+		size_t max_count,
+		std::function<bool(size_t i, SectorProofRef const& proof)> const& fn,
+		size_t* count) noexcept;
+	bool UnpackMultiproof(std::vector<uint64_t> const& challenges,
+		std::vector<char> const& packed_proof,
+		std::vector<SectorProof>& proofs, SectorItem* root) noexcept;
 private:
 	std::string const user_id_;
 	std::string const sector_id_;
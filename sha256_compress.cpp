@@ -6,8 +6,18 @@
 #include <string.h>
 #include <cassert>
 #include <random>
+#if defined(_WIN32)
 #include <winsock2.h>
 #include <windows.h>
+#endif
+
+#if defined(SHA256_COMPRESS_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
 
 namespace
 {
@@ -222,6 +232,164 @@ void Transform2(uint32_t* s, const uint32_t* chunk) {
 	s[7] += h;
 }
 
+/** Compress one block, hash may point at data. */
+void Compress2(const uint32_t* data, uint32_t* hash) {
+	uint32_t s[8];
+	Initialize(s);
+	Transform2(s, data);
+	memcpy(hash, s, sizeof(s));
+}
+
+typedef void(*Compress2Fn)(const uint32_t* data, uint32_t* hash);
+
+Compress2Fn compress2 = Compress2;
+
+template <size_t N>
+void Compress2Loop(const uint32_t* data, uint32_t* hash) {
+	for (size_t i = 0; i < N; ++i) {
+		compress2(data + i * 16, hash + i * 8);
+	}
+}
+
+Compress2Fn compress2_4way = Compress2Loop<4>;
+Compress2Fn compress2_8way = Compress2Loop<8>;
+Compress2Fn compress2_16way = Compress2Loop<16>;
+size_t batch_lanes = 1; // widest native lanes, used by Sha256Compress2Batch
+
+void Compress2_8wayBy4(const uint32_t* data, uint32_t* hash) {
+	compress2_4way(data, hash);
+	compress2_4way(data + 64, hash + 32);
+}
+
+void Compress2_16wayBy8(const uint32_t* data, uint32_t* hash) {
+	compress2_8way(data, hash);
+	compress2_8way(data + 128, hash + 64);
+}
+
+#if defined(SHA256_COMPRESS_X86)
+void Cpuid(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b,
+	uint32_t& c, uint32_t& d) {
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, (int)leaf, (int)subleaf);
+	a = (uint32_t)r[0];
+	b = (uint32_t)r[1];
+	c = (uint32_t)r[2];
+	d = (uint32_t)r[3];
+#else
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+#endif
+}
+
+uint64_t Xgetbv() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32_t a, d;
+	__asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return a | ((uint64_t)d << 32);
+#endif
+}
+#endif
+
+} // namespace
+
+#if defined(SHA256_COMPRESS_X86)
+namespace sha256_compress_shani {
+void Compress2(const uint32_t* data, uint32_t* hash);
+}
+
+namespace sha256_compress_sse41 {
+void Compress2_4way(const uint32_t* data, uint32_t* hash);
+}
+
+namespace sha256_compress_avx2 {
+void Compress2_8way(const uint32_t* data, uint32_t* hash);
+}
+
+namespace sha256_compress_avx512 {
+void Compress2_16way(const uint32_t* data, uint32_t* hash);
+}
+
+namespace {
+
+// the kernels this cpu and os can run
+struct CpuFeatures {
+	bool sse41 = false;
+	bool avx2 = false;
+	bool avx512 = false;
+	bool shani = false;
+};
+
+CpuFeatures DetectCpu() {
+	CpuFeatures features;
+	uint32_t a, b, c, d;
+	Cpuid(0, 0, a, b, c, d);
+	uint32_t max_leaf = a;
+	Cpuid(1, 0, a, b, c, d);
+	features.sse41 = (c >> 19) & 1;
+	bool have_xsave = ((c >> 27) & 1) && ((c >> 28) & 1); // osxsave, avx
+	if (max_leaf >= 7) {
+		Cpuid(7, 0, a, b, c, d);
+		features.shani = ((b >> 29) & 1) && features.sse41;
+		if (have_xsave) {
+			uint64_t xcr0 = Xgetbv();
+			features.avx2 = ((b >> 5) & 1) && (xcr0 & 0x6) == 0x6;
+			features.avx512 = ((b >> 16) & 1) && (xcr0 & 0xe6) == 0xe6;
+		}
+	}
+	return features;
+}
+
+} // namespace
+#endif
+
+std::string Sha256AutoDetect() {
+	std::string ret = "scalar";
+	compress2 = Compress2;
+	compress2_4way = Compress2Loop<4>;
+	compress2_8way = Compress2Loop<8>;
+	compress2_16way = Compress2Loop<16>;
+	batch_lanes = 1;
+
+#if defined(SHA256_COMPRESS_X86)
+	CpuFeatures const cpu = DetectCpu();
+
+	// one sha-ni stream outruns the sse4.1 and avx2 lanes, only the 16 avx-512
+	// lanes beat it
+	if (cpu.shani) {
+		compress2 = sha256_compress_shani::Compress2;
+		ret += ",shani(1way)";
+	}
+	if (cpu.sse41 && !cpu.shani) {
+		compress2_4way = sha256_compress_sse41::Compress2_4way;
+		compress2_8way = Compress2_8wayBy4;
+		compress2_16way = Compress2_16wayBy8;
+		batch_lanes = 4;
+		ret += ",sse41(4way)";
+	}
+	if (cpu.avx2 && !cpu.shani) {
+		compress2_8way = sha256_compress_avx2::Compress2_8way;
+		compress2_16way = Compress2_16wayBy8;
+		batch_lanes = 8;
+		ret += ",avx2(8way)";
+	}
+	if (cpu.avx512) {
+		compress2_16way = sha256_compress_avx512::Compress2_16way;
+		batch_lanes = 16;
+		ret += ",avx512(16way)";
+	}
+#endif
+
+	return ret;
+}
+
+namespace {
+struct AutoDetectAtStartup {
+	AutoDetectAtStartup() {
+		Sha256AutoDetect();
+	}
+} auto_detect_at_startup;
 } // namespace
 
 void Sha256Compress(const uint8_t data[64], uint8_t hash[32]) {
@@ -239,8 +407,36 @@ void Sha256Compress(const uint8_t data[64], uint8_t hash[32]) {
 }
 
 void Sha256Compress2(const uint32_t data[16], uint32_t hash[8]) {
-	Initialize(hash);
-	Transform2(hash, data);
+	compress2(data, hash);
+}
+
+void Sha256Compress2x4(const uint32_t data[64], uint32_t hash[32]) {
+	compress2_4way(data, hash);
+}
+
+void Sha256Compress2x8(const uint32_t data[128], uint32_t hash[64]) {
+	compress2_8way(data, hash);
+}
+
+void Sha256Compress2x16(const uint32_t data[256], uint32_t hash[128]) {
+	compress2_16way(data, hash);
+}
+
+void Sha256Compress2Batch(const uint32_t* data, uint32_t* hash, size_t count) {
+	if (batch_lanes >= 16) {
+		for (; count >= 16; count -= 16, data += 256, hash += 128)
+			compress2_16way(data, hash);
+	}
+	if (batch_lanes >= 8) {
+		for (; count >= 8; count -= 8, data += 128, hash += 64)
+			compress2_8way(data, hash);
+	}
+	if (batch_lanes >= 4) {
+		for (; count >= 4; count -= 4, data += 64, hash += 32)
+			compress2_4way(data, hash);
+	}
+	for (; count > 0; --count, data += 16, hash += 8)
+		compress2(data, hash);
 }
 
 //
@@ -304,6 +500,71 @@ void test_sha256_compress() {
 		}
 	}
 
+	// multi-lane and batch against the scalar path
+	{
+		uint32_t data[16 * 23];
+		for (auto& i : data) i = rd();
+
+		uint32_t expect[8 * 23];
+		for (int i = 0; i < 23; ++i) {
+			Sha256Compress2(data + i * 16, expect + i * 8);
+		}
+
+		uint32_t out[8 * 23];
+		Sha256Compress2x4(data, out);
+		assert(memcmp(out, expect, sizeof(uint32_t) * 8 * 4) == 0);
+
+		Sha256Compress2x8(data, out);
+		assert(memcmp(out, expect, sizeof(uint32_t) * 8 * 8) == 0);
+
+		Sha256Compress2x16(data, out);
+		assert(memcmp(out, expect, sizeof(uint32_t) * 8 * 16) == 0);
+
+		for (size_t count = 0; count <= 23; ++count) {
+			memset(out, 0, sizeof(out));
+			Sha256Compress2Batch(data, out, count);
+			assert(memcmp(out, expect, sizeof(uint32_t) * 8 * count) == 0);
+		}
+
+		// in place, as merkle levels are built
+		Sha256Compress2Batch(data, data, 23);
+		assert(memcmp(data, expect, sizeof(expect)) == 0);
+	}
+
+	// every kernel this cpu runs, not only the ones picked above, against
+	// the scalar one
+	{
+		uint32_t data[16 * 16];
+		for (auto& i : data) i = rd();
+		uint32_t expect[8 * 16];
+		for (int i = 0; i < 16; ++i) {
+			Compress2(data + i * 16, expect + i * 8);
+		}
+
+		std::vector<std::pair<Compress2Fn, int>> kernels{
+			{ Compress2Loop<4>, 4 }, { Compress2Loop<8>, 8 },
+			{ Compress2Loop<16>, 16 } };
+#if defined(SHA256_COMPRESS_X86)
+		CpuFeatures const cpu = DetectCpu();
+		if (cpu.shani)
+			kernels.emplace_back(sha256_compress_shani::Compress2, 1);
+		if (cpu.sse41)
+			kernels.emplace_back(sha256_compress_sse41::Compress2_4way, 4);
+		if (cpu.avx2)
+			kernels.emplace_back(sha256_compress_avx2::Compress2_8way, 8);
+		if (cpu.avx512) {
+			kernels.emplace_back(sha256_compress_avx512::Compress2_16way,
+				16);
+		}
+#endif
+		for (auto const& kernel : kernels) {
+			uint32_t out[8 * 16];
+			kernel.first(data, out);
+			assert(memcmp(out, expect, sizeof(uint32_t) * 8 *
+				kernel.second) == 0);
+		}
+	}
+
 	//uint32_t data0[16] = { 0x61626364, 0x31323334 };
 	//uint32_t hash[8];
 	//Sha256Compress2(data0, hash);
@@ -1,9 +1,16 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string>
 
 #define SHA256_DIGESTSIZE 32
 
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__) || \
+	defined(_M_X64) || defined(_M_IX86)
+#define SHA256_COMPRESS_X86
+#endif
+
 uint32_t inline ReadBE32(const uint8_t* ptr) {
 	return ((uint32_t) *((ptr)+3)) | ((uint32_t) *((ptr)+2) << 8) |
 		((uint32_t) *((ptr)+1) << 16) | ((uint32_t) *((ptr)+0) << 24);
@@ -18,4 +25,22 @@ void inline WriteBE32(uint8_t* ptr, uint32_t x) {
 
 void Sha256Compress(const uint8_t data[64], uint8_t hash[32]);
 
-void Sha256Compress2(const uint32_t data[16], uint32_t hash[8]);
\ No newline at end of file
+// Compress one block of host-order words, using the sha extensions when the
+// cpu has them. hash may point at data.
+void Sha256Compress2(const uint32_t data[16], uint32_t hash[8]);
+
+// Compress 4/8/16 independent blocks per call. data holds the blocks back to
+// back (16 words each), hash receives the states back to back (8 words each).
+void Sha256Compress2x4(const uint32_t data[64], uint32_t hash[32]);
+
+void Sha256Compress2x8(const uint32_t data[128], uint32_t hash[64]);
+
+void Sha256Compress2x16(const uint32_t data[256], uint32_t hash[128]);
+
+// Compress count blocks with the widest lanes available. hash may point at
+// data, every state only overwrites blocks that were already compressed.
+void Sha256Compress2Batch(const uint32_t* data, uint32_t* hash, size_t count);
+
+// Select the fastest implementations supported by this cpu, return their
+// names. It runs once at startup, calling it again is harmless.
+std::string Sha256AutoDetect();
@@ -0,0 +1,46 @@
+// 8-way SHA-256 compression using AVX2, compiled with -mavx2 on gcc/clang.
+
+#include "sha256_compress.h"
+
+#if defined(SHA256_COMPRESS_X86)
+#include <immintrin.h>
+#include "sha256_compress_lanes.h"
+
+namespace sha256_compress_avx2 {
+namespace {
+struct V {
+	typedef __m256i T;
+	static int const kLanes = 8;
+
+	static T Set1(uint32_t x) { return _mm256_set1_epi32((int)x); }
+	static T Add(T x, T y) { return _mm256_add_epi32(x, y); }
+	static T Xor(T x, T y) { return _mm256_xor_si256(x, y); }
+	static T And(T x, T y) { return _mm256_and_si256(x, y); }
+	static T Or(T x, T y) { return _mm256_or_si256(x, y); }
+	template <int N> static T Shr(T x) { return _mm256_srli_epi32(x, N); }
+	template <int N> static T Ror(T x) {
+		return _mm256_or_si256(_mm256_srli_epi32(x, N),
+			_mm256_slli_epi32(x, 32 - N));
+	}
+
+	static T Gather(const uint32_t* data, int j) {
+		T const index = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+		return _mm256_i32gather_epi32((int const*)(data + j), index, 4);
+	}
+
+	static void Scatter(uint32_t* hash, int j, T x) {
+		alignas(32) uint32_t lanes[8];
+		_mm256_store_si256((T*)lanes, x);
+		for (int i = 0; i < 8; ++i) {
+			hash[i * 8 + j] = lanes[i];
+		}
+	}
+};
+} // namespace
+
+void Compress2_8way(const uint32_t* data, uint32_t* hash) {
+	sha256_lanes::Compress<V>(data, hash);
+}
+} // namespace sha256_compress_avx2
+
+#endif
@@ -0,0 +1,43 @@
+// 16-way SHA-256 compression using AVX-512F, compiled with -mavx512f on
+// gcc/clang.
+
+#include "sha256_compress.h"
+
+#if defined(SHA256_COMPRESS_X86)
+#include <immintrin.h>
+#include "sha256_compress_lanes.h"
+
+namespace sha256_compress_avx512 {
+namespace {
+struct V {
+	typedef __m512i T;
+	static int const kLanes = 16;
+
+	static T Set1(uint32_t x) { return _mm512_set1_epi32((int)x); }
+	static T Add(T x, T y) { return _mm512_add_epi32(x, y); }
+	static T Xor(T x, T y) { return _mm512_xor_si512(x, y); }
+	static T And(T x, T y) { return _mm512_and_si512(x, y); }
+	static T Or(T x, T y) { return _mm512_or_si512(x, y); }
+	template <int N> static T Shr(T x) { return _mm512_srli_epi32(x, N); }
+	template <int N> static T Ror(T x) { return _mm512_ror_epi32(x, N); }
+
+	static T Gather(const uint32_t* data, int j) {
+		T const index = _mm512_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112,
+			128, 144, 160, 176, 192, 208, 224, 240);
+		return _mm512_i32gather_epi32(index, (int const*)(data + j), 4);
+	}
+
+	static void Scatter(uint32_t* hash, int j, T x) {
+		T const index = _mm512_setr_epi32(0, 8, 16, 24, 32, 40, 48, 56,
+			64, 72, 80, 88, 96, 104, 112, 120);
+		_mm512_i32scatter_epi32((int*)(hash + j), index, x, 4);
+	}
+};
+} // namespace
+
+void Compress2_16way(const uint32_t* data, uint32_t* hash) {
+	sha256_lanes::Compress<V>(data, hash);
+}
+} // namespace sha256_compress_avx512
+
+#endif
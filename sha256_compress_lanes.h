@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+
+// Multi-lane SHA-256 compression shared by the SIMD kernels. Every lane
+// compresses its own 64-byte block, V supplies the vector operations. V must
+// be defined inside the kernel's translation unit, so the instantiation is
+// compiled with that unit's instruction set only.
+//
+// data holds V::kLanes blocks back to back (16 words each), hash receives
+// V::kLanes states back to back (8 words each). All input is gathered before
+// any output is written, so hash may alias the start of data.
+
+namespace sha256_lanes {
+
+static uint32_t const kK[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+static uint32_t const kInit[8] = {
+	0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul,
+	0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul };
+
+template <typename V>
+typename V::T Sigma0(typename V::T x) {
+	return V::Xor(V::Xor(V::template Ror<2>(x), V::template Ror<13>(x)),
+		V::template Ror<22>(x));
+}
+
+template <typename V>
+typename V::T Sigma1(typename V::T x) {
+	return V::Xor(V::Xor(V::template Ror<6>(x), V::template Ror<11>(x)),
+		V::template Ror<25>(x));
+}
+
+template <typename V>
+typename V::T sigma0(typename V::T x) {
+	return V::Xor(V::Xor(V::template Ror<7>(x), V::template Ror<18>(x)),
+		V::template Shr<3>(x));
+}
+
+template <typename V>
+typename V::T sigma1(typename V::T x) {
+	return V::Xor(V::Xor(V::template Ror<17>(x), V::template Ror<19>(x)),
+		V::template Shr<10>(x));
+}
+
+template <typename V>
+void Compress(const uint32_t* data, uint32_t* hash) {
+	typedef typename V::T T;
+
+	T w[16];
+	for (int j = 0; j < 16; ++j) {
+		w[j] = V::Gather(data, j);
+	}
+
+	T a = V::Set1(kInit[0]), b = V::Set1(kInit[1]);
+	T c = V::Set1(kInit[2]), d = V::Set1(kInit[3]);
+	T e = V::Set1(kInit[4]), f = V::Set1(kInit[5]);
+	T g = V::Set1(kInit[6]), h = V::Set1(kInit[7]);
+
+	for (int i = 0; i < 64; ++i) {
+		T wi;
+		if (i < 16) {
+			wi = w[i];
+		} else {
+			T s0 = sigma0<V>(w[(i + 1) & 15]);
+			T s1 = sigma1<V>(w[(i + 14) & 15]);
+			wi = V::Add(V::Add(w[i & 15], s0), V::Add(w[(i + 9) & 15], s1));
+			w[i & 15] = wi;
+		}
+
+		T ch = V::Xor(g, V::And(e, V::Xor(f, g)));
+		T t1 = V::Add(V::Add(h, Sigma1<V>(e)),
+			V::Add(V::Add(ch, V::Set1(kK[i])), wi));
+		T maj = V::Or(V::And(a, b), V::And(c, V::Or(a, b)));
+		T t2 = V::Add(Sigma0<V>(a), maj);
+		h = g;
+		g = f;
+		f = e;
+		e = V::Add(d, t1);
+		d = c;
+		c = b;
+		b = a;
+		a = V::Add(t1, t2);
+	}
+
+	V::Scatter(hash, 0, V::Add(a, V::Set1(kInit[0])));
+	V::Scatter(hash, 1, V::Add(b, V::Set1(kInit[1])));
+	V::Scatter(hash, 2, V::Add(c, V::Set1(kInit[2])));
+	V::Scatter(hash, 3, V::Add(d, V::Set1(kInit[3])));
+	V::Scatter(hash, 4, V::Add(e, V::Set1(kInit[4])));
+	V::Scatter(hash, 5, V::Add(f, V::Set1(kInit[5])));
+	V::Scatter(hash, 6, V::Add(g, V::Set1(kInit[6])));
+	V::Scatter(hash, 7, V::Add(h, V::Set1(kInit[7])));
+}
+
+} // namespace sha256_lanes
@@ -0,0 +1,105 @@
+// Single-stream SHA-256 compression using the Intel SHA extensions, compiled
+// with -msse4.1 -msha on gcc/clang. Based on the sha256rnds2 sequence of
+// Bitcoin Core's sha256_x86_shani.cpp.
+
+#include "sha256_compress.h"
+
+#if defined(SHA256_COMPRESS_X86)
+#include <immintrin.h>
+
+namespace sha256_compress_shani {
+namespace {
+inline void QuadRound(__m128i& s0, __m128i& s1, __m128i m, uint64_t k1,
+	uint64_t k0) {
+	__m128i const msg = _mm_add_epi32(m, _mm_set_epi64x(k1, k0));
+	s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+	s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+inline void ShiftMessageA(__m128i& m0, __m128i m1) {
+	m0 = _mm_sha256msg1_epu32(m0, m1);
+}
+
+inline void ShiftMessageC(__m128i& m0, __m128i m1, __m128i& m2) {
+	m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m1, m0, 4)),
+		m1);
+}
+
+inline void ShiftMessageB(__m128i& m0, __m128i m1, __m128i& m2) {
+	ShiftMessageC(m0, m1, m2);
+	ShiftMessageA(m0, m1);
+}
+
+// abcd efgh -> abef cdgh, the order sha256rnds2 wants
+inline void Shuffle(__m128i& s0, __m128i& s1) {
+	__m128i const t1 = _mm_shuffle_epi32(s0, 0xb1);
+	__m128i const t2 = _mm_shuffle_epi32(s1, 0x1b);
+	s0 = _mm_alignr_epi8(t1, t2, 0x08);
+	s1 = _mm_blend_epi16(t2, t1, 0xf0);
+}
+
+inline void Unshuffle(__m128i& s0, __m128i& s1) {
+	__m128i const t1 = _mm_shuffle_epi32(s0, 0x1b);
+	__m128i const t2 = _mm_shuffle_epi32(s1, 0xb1);
+	s0 = _mm_blend_epi16(t1, t2, 0xf0);
+	s1 = _mm_alignr_epi8(t2, t1, 0x08);
+}
+} // namespace
+
+// The block is already host-order words, so unlike the byte oriented
+// Transform no byte swap is needed on load. hash may point at data.
+void Compress2(const uint32_t* data, uint32_t* hash) {
+	__m128i m0, m1, m2, m3, s0, s1, so0, so1;
+
+	s0 = _mm_set_epi32(0xa54ff53a, 0x3c6ef372, 0xbb67ae85, 0x6a09e667);
+	s1 = _mm_set_epi32(0x5be0cd19, 0x1f83d9ab, 0x9b05688c, 0x510e527f);
+	Shuffle(s0, s1);
+	so0 = s0;
+	so1 = s1;
+
+	m0 = _mm_loadu_si128((__m128i const*)data);
+	m1 = _mm_loadu_si128((__m128i const*)(data + 4));
+	m2 = _mm_loadu_si128((__m128i const*)(data + 8));
+	m3 = _mm_loadu_si128((__m128i const*)(data + 12));
+
+	QuadRound(s0, s1, m0, 0xe9b5dba5b5c0fbcfull, 0x71374491428a2f98ull);
+	QuadRound(s0, s1, m1, 0xab1c5ed5923f82a4ull, 0x59f111f13956c25bull);
+	ShiftMessageA(m0, m1);
+	QuadRound(s0, s1, m2, 0x550c7dc3243185beull, 0x12835b01d807aa98ull);
+	ShiftMessageA(m1, m2);
+	QuadRound(s0, s1, m3, 0xc19bf1749bdc06a7ull, 0x80deb1fe72be5d74ull);
+	ShiftMessageB(m2, m3, m0);
+	QuadRound(s0, s1, m0, 0x240ca1cc0fc19dc6ull, 0xefbe4786e49b69c1ull);
+	ShiftMessageB(m3, m0, m1);
+	QuadRound(s0, s1, m1, 0x76f988da5cb0a9dcull, 0x4a7484aa2de92c6full);
+	ShiftMessageB(m0, m1, m2);
+	QuadRound(s0, s1, m2, 0xbf597fc7b00327c8ull, 0xa831c66d983e5152ull);
+	ShiftMessageB(m1, m2, m3);
+	QuadRound(s0, s1, m3, 0x1429296706ca6351ull, 0xd5a79147c6e00bf3ull);
+	ShiftMessageB(m2, m3, m0);
+	QuadRound(s0, s1, m0, 0x53380d134d2c6dfcull, 0x2e1b213827b70a85ull);
+	ShiftMessageB(m3, m0, m1);
+	QuadRound(s0, s1, m1, 0x92722c8581c2c92eull, 0x766a0abb650a7354ull);
+	ShiftMessageB(m0, m1, m2);
+	QuadRound(s0, s1, m2, 0xc76c51a3c24b8b70ull, 0xa81a664ba2bfe8a1ull);
+	ShiftMessageB(m1, m2, m3);
+	QuadRound(s0, s1, m3, 0x106aa070f40e3585ull, 0xd6990624d192e819ull);
+	ShiftMessageB(m2, m3, m0);
+	QuadRound(s0, s1, m0, 0x34b0bcb52748774cull, 0x1e376c0819a4c116ull);
+	ShiftMessageB(m3, m0, m1);
+	QuadRound(s0, s1, m1, 0x682e6ff35b9cca4full, 0x4ed8aa4a391c0cb3ull);
+	ShiftMessageC(m0, m1, m2);
+	QuadRound(s0, s1, m2, 0x8cc7020884c87814ull, 0x78a5636f748f82eeull);
+	ShiftMessageC(m1, m2, m3);
+	QuadRound(s0, s1, m3, 0xc67178f2bef9a3f7ull, 0xa4506ceb90befffaull);
+
+	s0 = _mm_add_epi32(s0, so0);
+	s1 = _mm_add_epi32(s1, so1);
+
+	Unshuffle(s0, s1);
+	_mm_storeu_si128((__m128i*)hash, s0);
+	_mm_storeu_si128((__m128i*)(hash + 4), s1);
+}
+} // namespace sha256_compress_shani
+
+#endif
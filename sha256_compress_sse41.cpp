@@ -0,0 +1,44 @@
+// 4-way SHA-256 compression using SSE4.1, compiled with -msse4.1 on gcc/clang.
+
+#include "sha256_compress.h"
+
+#if defined(SHA256_COMPRESS_X86)
+#include <smmintrin.h>
+#include "sha256_compress_lanes.h"
+
+namespace sha256_compress_sse41 {
+namespace {
+struct V {
+	typedef __m128i T;
+	static int const kLanes = 4;
+
+	static T Set1(uint32_t x) { return _mm_set1_epi32((int)x); }
+	static T Add(T x, T y) { return _mm_add_epi32(x, y); }
+	static T Xor(T x, T y) { return _mm_xor_si128(x, y); }
+	static T And(T x, T y) { return _mm_and_si128(x, y); }
+	static T Or(T x, T y) { return _mm_or_si128(x, y); }
+	template <int N> static T Shr(T x) { return _mm_srli_epi32(x, N); }
+	template <int N> static T Ror(T x) {
+		return _mm_or_si128(_mm_srli_epi32(x, N), _mm_slli_epi32(x, 32 - N));
+	}
+
+	static T Gather(const uint32_t* data, int j) {
+		return _mm_set_epi32((int)data[48 + j], (int)data[32 + j],
+			(int)data[16 + j], (int)data[j]);
+	}
+
+	static void Scatter(uint32_t* hash, int j, T x) {
+		hash[j] = (uint32_t)_mm_extract_epi32(x, 0);
+		hash[8 + j] = (uint32_t)_mm_extract_epi32(x, 1);
+		hash[16 + j] = (uint32_t)_mm_extract_epi32(x, 2);
+		hash[24 + j] = (uint32_t)_mm_extract_epi32(x, 3);
+	}
+};
+} // namespace
+
+void Compress2_4way(const uint32_t* data, uint32_t* hash) {
+	sha256_lanes::Compress<V>(data, hash);
+}
+} // namespace sha256_compress_sse41
+
+#endif
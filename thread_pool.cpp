@@ -0,0 +1,167 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t thread_count)
+	: next_worker_(0) {
+	if (thread_count == 0) {
+		thread_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+	if (thread_count <= 1)
+		return;
+
+	for (size_t i = 0; i < thread_count; ++i) {
+		workers_.emplace_back(new Worker);
+	}
+	for (size_t i = 0; i < thread_count; ++i) {
+		threads_.emplace_back([this, i]() { WorkerMain(i); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	for (auto& thread : threads_) {
+		thread.join();
+	}
+}
+
+size_t ThreadPool::thread_count() const noexcept {
+	return std::max<size_t>(threads_.size(), 1);
+}
+
+void ThreadPool::ParallelFor(uint64_t begin, uint64_t end, uint64_t grain,
+	RangeFn const& fn) noexcept {
+	if (end <= begin)
+		return;
+	grain = std::max<uint64_t>(grain, 1);
+
+	if (threads_.empty()) {
+		for (uint64_t i = begin; i < end; i += grain) {
+			fn(i, std::min(i + grain, end));
+		}
+		return;
+	}
+
+	Job job;
+	job.fn = &fn;
+	job.grain = grain;
+	job.left = end - begin;
+	job.done = false;
+	Push(next_worker_++ % workers_.size(), Task{ &job, begin, end });
+
+	std::unique_lock<std::mutex> lock(job.mutex);
+	job.cv.wait(lock, [&job]() { return job.done; });
+}
+
+void ThreadPool::Push(size_t worker, Task const& task) noexcept {
+	{
+		std::lock_guard<std::mutex> lock(workers_[worker]->mutex);
+		workers_[worker]->tasks.push_back(task);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		++pending_;
+	}
+	cv_.notify_one();
+}
+
+bool ThreadPool::Pop(size_t worker, Task& task) noexcept {
+	{
+		std::lock_guard<std::mutex> lock(workers_[worker]->mutex);
+		auto& tasks = workers_[worker]->tasks;
+		if (tasks.empty())
+			return false;
+		task = tasks.back();
+		tasks.pop_back();
+	}
+	std::lock_guard<std::mutex> lock(mutex_);
+	--pending_;
+	return true;
+}
+
+bool ThreadPool::Steal(size_t worker, Task& task) noexcept {
+	for (size_t i = 1; i < workers_.size(); ++i) {
+		size_t victim = (worker + i) % workers_.size();
+		{
+			std::lock_guard<std::mutex> lock(workers_[victim]->mutex);
+			auto& tasks = workers_[victim]->tasks;
+			if (tasks.empty())
+				continue;
+			task = tasks.front();
+			tasks.pop_front();
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		--pending_;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::Run(size_t worker, Task task) noexcept {
+	Job* job = task.job;
+	// keep the left half, leave the right half to us later or to a thief
+	while (task.end - task.begin > job->grain) {
+		uint64_t mid = task.begin + (task.end - task.begin) / 2;
+		Push(worker, Task{ job, mid, task.end });
+		task.end = mid;
+	}
+
+	(*job->fn)(task.begin, task.end);
+
+	if (job->left.fetch_sub(task.end - task.begin) == task.end - task.begin) {
+		// notified under the lock, the job lives until it is released
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		job->cv.notify_all();
+	}
+}
+
+void ThreadPool::WorkerMain(size_t worker) noexcept {
+	for (;;) {
+		Task task;
+		if (Pop(worker, task) || Steal(worker, task)) {
+			Run(worker, task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		cv_.wait(lock, [this]() { return stop_ || pending_ > 0; });
+		if (stop_ && pending_ == 0)
+			return;
+	}
+}
+
+// many small jobs from several callers at once, each range run once. The
+// caller returns as soon as the last range is done, so a worker still
+// touching the job after that shows up here as a crash or a hang.
+void test_thread_pool() {
+	for (size_t thread_count : { 0, 1, 2, 4, 8 }) {
+		ThreadPool pool(thread_count);
+		std::vector<std::thread> callers;
+		for (size_t c = 0; c < 4; ++c) {
+			callers.emplace_back([&pool, c]() {
+				std::mt19937_64 rng(c);
+				for (size_t round = 0; round < 2000; ++round) {
+					uint64_t begin = rng() % 100;
+					uint64_t end = begin + rng() % 300;
+					uint64_t grain = 1 + rng() % 16;
+					std::vector<std::atomic<uint32_t>> hits(end);
+					for (auto& hit : hits) hit = 0;
+					pool.ParallelFor(begin, end, grain,
+						[&hits, grain](uint64_t b, uint64_t e) {
+						assert(e > b && e - b <= grain);
+						for (uint64_t i = b; i < e; ++i) ++hits[i];
+					});
+					for (uint64_t i = 0; i < end; ++i) {
+						assert(hits[i] == (i >= begin ? 1u : 0u));
+					}
+				}
+			});
+		}
+		for (auto& caller : callers) {
+			caller.join();
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "public.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// Work-stealing pool for data parallel passes. Every worker owns a deque of
+// ranges: it splits and runs ranges from the back of its own deque and steals
+// from the front of the others, where the biggest ranges are, once it runs
+// dry. With thread_count <= 1 no thread is started and the caller runs
+// everything inline.
+class ThreadPool : private boost::noncopyable {
+public:
+	typedef std::function<void(uint64_t begin, uint64_t end)> RangeFn;
+
+	// 0 means one thread per core
+	explicit ThreadPool(size_t thread_count);
+
+	~ThreadPool();
+
+	size_t thread_count() const noexcept;
+
+	// Call fn on disjoint ranges of at most grain indexes covering
+	// [begin, end), wait until all returned. fn must not throw.
+	void ParallelFor(uint64_t begin, uint64_t end, uint64_t grain,
+		RangeFn const& fn) noexcept;
+
+private:
+	struct Job {
+		RangeFn const* fn;
+		uint64_t grain;
+		std::atomic<uint64_t> left;
+		// set by the worker finishing the last range, under mutex: the
+		// caller may free the job only once that worker let go of it
+		bool done;
+		std::mutex mutex;
+		std::condition_variable cv;
+	};
+
+	struct Task {
+		Job* job;
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void Push(size_t worker, Task const& task) noexcept;
+	bool Pop(size_t worker, Task& task) noexcept;
+	bool Steal(size_t worker, Task& task) noexcept;
+	void Run(size_t worker, Task task) noexcept;
+	void WorkerMain(size_t worker) noexcept;
+
+private:
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	uint64_t pending_ = 0; // queued tasks, guarded by mutex_
+	bool stop_ = false;
+	std::atomic<size_t> next_worker_;
+};
@@ -1,26 +1,57 @@
 #pragma once
 
 #include "public.h"
+#include "sector_metrics.h"
 
+// records the time of a scope as a phase, see SectorMetrics, and prints it
+// when console() is on. print false only records, for phases too frequent
+// to log.
 struct Tick {
-	Tick(std::string desc)
-		: desc_(std::move(desc))
+	// name must stay valid, e.g. __FUNCTION__ or a literal: it is recorded
+	// without a copy or a lookup by name
+	Tick(char const* name, bool print = true)
+		: name_(name)
+		, print_(print)
+		, start_(std::chrono::steady_clock::now()) {
+	}
+	Tick(std::string desc, bool print = true)
+		: name_(nullptr)
+		, desc_(std::move(desc))
+		, print_(print)
 		, start_(std::chrono::steady_clock::now()) {		
 	}
 	~Tick() {
 		auto now = std::chrono::steady_clock::now();
 		auto period = now - start_;
+		double seconds = std::chrono::duration<double>(period).count();
+		if (name_) {
+			SectorMetrics::Record(name_, seconds);
+		} else {
+			SectorMetrics::Record(desc_, seconds);
+		}
+		if (!print_ || !console())
+			return;
+		std::string const desc = name_ ? std::string(name_) : desc_;
 		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
 			period).count();
 		if (ms > 10 * 60 * 1000) {
-			std::cout << desc_ << " tick: " << ms / (1000 * 60) << "m";
+			std::cout << desc << " tick: " << ms / (1000 * 60) << "m";
 		} else if (ms > 10 * 1000) {
-			std::cout << desc_ << " tick: " << ms / 1000 << "s";
+			std::cout << desc << " tick: " << ms / 1000 << "s";
 		} else {
-			std::cout << desc_ << " tick: " << ms << "ms";
+			std::cout << desc << " tick: " << ms << "ms";
 		}
 		std::cout << std::endl;		
 	}
+	// off by default, the metrics have the times. A command line tool turns
+	// it on to log its phases.
+	static std::atomic<bool>& console() {
+		static std::atomic<bool> console(false);
+		return console;
+	}
+
+	char const* name_;
 	std::string desc_;
+	bool print_;
 	std::chrono::steady_clock::time_point start_;
 };
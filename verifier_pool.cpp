@@ -0,0 +1,218 @@
+#include "verifier_pool.h"
+#include "sector_verifier.h"
+#include "sector_prover.h"
+#include "tick.h"
+
+VerifierPool::VerifierPool(size_t thread_count, size_t cache_size)
+	: cache_size_(std::max<size_t>(cache_size, 1)) {
+	if (thread_count == 0) {
+		thread_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+	for (size_t i = 0; i < thread_count; ++i) {
+		threads_.emplace_back([this]() { WorkerMain(); });
+	}
+}
+
+VerifierPool::~VerifierPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	for (auto& thread : threads_) {
+		thread.join();
+	}
+}
+
+size_t VerifierPool::thread_count() const noexcept {
+	return threads_.size();
+}
+
+std::future<bool> VerifierPool::Verify(SectorDescriptor const& sector,
+	std::vector<uint64_t> challenges,
+	std::vector<char> packed_proofs) noexcept {
+	auto promise = std::make_shared<std::promise<bool>>();
+	auto future = promise->get_future();
+	Verify(sector, std::move(challenges), std::move(packed_proofs),
+		[promise](bool ok) {
+		promise->set_value(ok);
+	});
+	return future;
+}
+
+void VerifierPool::Verify(SectorDescriptor const& sector,
+	std::vector<uint64_t> challenges, std::vector<char> packed_proofs,
+	VerifyCallback callback) noexcept {
+	Job job;
+	job.sector = sector;
+	job.challenges = std::move(challenges);
+	job.packed_proofs = std::move(packed_proofs);
+	job.callback = std::move(callback);
+	Push(std::move(job));
+}
+
+void VerifierPool::Push(Job job) noexcept {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		jobs_.push_back(std::move(job));
+	}
+	cv_.notify_one();
+}
+
+void VerifierPool::WorkerMain() noexcept {
+	for (;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+			if (jobs_.empty())
+				return;
+			job = std::move(jobs_.front());
+			jobs_.pop_front();
+		}
+
+		bool ok = Run(job);
+		if (job.callback)
+			job.callback(ok);
+	}
+}
+
+bool VerifierPool::Run(Job const& job) noexcept {
+	// an empty batch would kill the process in VerifyPackedProofs
+	if (job.challenges.empty())
+		return false;
+
+	auto verifier = GetVerifier(job.sector);
+	if (!verifier)
+		return false;
+	return verifier->VerifyPackedProofs(job.challenges, job.packed_proofs);
+}
+
+std::shared_ptr<SectorVerifier> VerifierPool::GetVerifier(
+	SectorDescriptor const& sector) noexcept {
+	std::string key = sector.user_id + "\n" + sector.sector_id + "\n" +
+		std::to_string(sector.data_size) + "\n" + sector.mkl_root.to_string();
+
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex_);
+		auto it = cache_.find(key);
+		if (it != cache_.end()) {
+			lru_.splice(lru_.begin(), lru_, it->second);
+			return it->second->second;
+		}
+	}
+
+	// built outside the lock, a racing job of the same sector builds its own
+	std::shared_ptr<SectorVerifier> verifier;
+	try {
+		verifier = std::make_shared<SectorVerifier>(sector.user_id,
+			sector.sector_id, sector.data_size, sector.mkl_root);
+	} catch (std::exception&) {
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(cache_mutex_);
+	if (cache_.count(key))
+		return verifier;
+	lru_.emplace_front(key, verifier);
+	cache_[key] = lru_.begin();
+	if (lru_.size() > cache_size_) {
+		cache_.erase(lru_.back().first);
+		lru_.pop_back();
+	}
+	return verifier;
+}
+
+void test_verifier_pool() {
+	size_t const kSectorCount = 8;
+	size_t const kJobCount = 64; // per sector
+	size_t const kChallengeCount = 16; // per job
+	uint64_t const data_size = kSectorSizeM;
+
+	auto path = fs::temp_directory_path() / "test_verifier_pool";
+	fs::remove_all(path);
+	fs::create_directories(path);
+
+	struct Pending {
+		SectorDescriptor sector;
+		std::vector<uint64_t> challenges;
+		std::vector<char> packed_proofs;
+	};
+	std::vector<Pending> pendings;
+	std::mt19937_64 rng(1);
+	for (size_t i = 0; i < kSectorCount; ++i) {
+		SectorDescriptor sector;
+		sector.user_id = "abcd";
+		sector.sector_id = std::to_string(i);
+		sector.data_size = data_size;
+		SectorProver prover(sector.user_id, sector.sector_id, data_size,
+			path.string());
+		bool created = prover.Create(nullptr);
+		assert(created);
+		(void)created;
+		sector.mkl_root = prover.mkl_root();
+
+		for (size_t j = 0; j < kJobCount; ++j) {
+			Pending pending;
+			pending.sector = sector;
+			for (size_t k = 0; k < kChallengeCount; ++k) {
+				pending.challenges.push_back(rng());
+			}
+			pending.packed_proofs = prover.GeneratePackedProofs(
+				pending.challenges, nullptr);
+			pendings.push_back(std::move(pending));
+		}
+	}
+	fs::remove_all(path);
+
+	VerifierPool pool;
+	std::atomic<size_t> passed(0);
+	std::atomic<size_t> done(0);
+	{
+		Tick tick("verify " + std::to_string(pendings.size()) + " jobs of " +
+			std::to_string(kChallengeCount) + " proofs on " +
+			std::to_string(pool.thread_count()) + " threads");
+
+		// submit from several threads, half through futures
+		size_t const kSubmitters = 4;
+		std::vector<std::thread> submitters;
+		for (size_t s = 0; s < kSubmitters; ++s) {
+			submitters.emplace_back([&, s]() {
+				std::vector<std::future<bool>> futures;
+				for (size_t i = s; i < pendings.size(); i += kSubmitters) {
+					auto const& pending = pendings[i];
+					if (i % 2) {
+						futures.push_back(pool.Verify(pending.sector,
+							pending.challenges, pending.packed_proofs));
+					} else {
+						pool.Verify(pending.sector, pending.challenges,
+							pending.packed_proofs, [&](bool ok) {
+							if (ok) ++passed;
+							++done;
+						});
+					}
+				}
+				for (auto& future : futures) {
+					if (future.get()) ++passed;
+					++done;
+				}
+			});
+		}
+		for (auto& submitter : submitters) {
+			submitter.join();
+		}
+		// the callbacks of the last jobs may still run
+		while (done < pendings.size()) {
+			std::this_thread::yield();
+		}
+	}
+	assert(passed == pendings.size());
+
+	// a wrong root fails, the sector is then cached under the new root
+	auto pending = pendings[0];
+	pending.sector.mkl_root = pendings[kJobCount].sector.mkl_root;
+	bool ok = pool.Verify(pending.sector, pending.challenges,
+		pending.packed_proofs).get();
+	assert(!ok);
+	(void)ok;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "public.h"
+#include "sector_misc.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <list>
+
+class SectorVerifier;
+
+// what the audit side knows of a sector
+struct SectorDescriptor {
+	std::string user_id;
+	std::string sector_id;
+	uint64_t data_size;
+	SectorItem mkl_root;
+};
+
+// Verify packed proofs of many sectors on a fixed set of threads. Jobs may
+// be queued from any thread and run in queue order. The verifier of a
+// sector (prefix, d0, root) is built once and kept in a LRU cache, so the
+// jobs of a sector only pay for their proofs.
+class VerifierPool : private boost::noncopyable {
+public:
+	typedef std::function<void(bool ok)> VerifyCallback;
+
+	// 0 means one thread per core, cache_size is the number of sectors kept
+	explicit VerifierPool(size_t thread_count = 0, size_t cache_size = 4096);
+
+	// runs the queued jobs first
+	~VerifierPool();
+
+	size_t thread_count() const noexcept;
+
+	std::future<bool> Verify(SectorDescriptor const& sector,
+		std::vector<uint64_t> challenges,
+		std::vector<char> packed_proofs) noexcept;
+
+	// callback is called on a pool thread
+	void Verify(SectorDescriptor const& sector,
+		std::vector<uint64_t> challenges, std::vector<char> packed_proofs,
+		VerifyCallback callback) noexcept;
+
+private:
+	struct Job {
+		SectorDescriptor sector;
+		std::vector<uint64_t> challenges;
+		std::vector<char> packed_proofs;
+		VerifyCallback callback;
+	};
+
+	void Push(Job job) noexcept;
+	void WorkerMain() noexcept;
+	bool Run(Job const& job) noexcept;
+	std::shared_ptr<SectorVerifier> GetVerifier(
+		SectorDescriptor const& sector) noexcept;
+
+private:
+	typedef std::pair<std::string, std::shared_ptr<SectorVerifier>> Entry;
+
+	size_t const cache_size_;
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<Job> jobs_; // guarded by mutex_
+	bool stop_ = false;
+
+	std::mutex cache_mutex_;
+	std::list<Entry> lru_; // most recent first, guarded by cache_mutex_
+	std::unordered_map<std::string, std::list<Entry>::iterator> cache_;
+};